@@ -34,7 +34,7 @@ if [ ! -f $EV_ROOT/Makefile.am.ORG ]; then
   line=`grep -n 'SYS_LIBS =' $EV_ROOT/Makefile.am.ORG | tail -1 | cut -d ':' -f1`
   cat $EV_ROOT/Makefile.am.ORG | sed -e 's|EXTRAS_SRC =\(.*\)|EXTRAS_SRC = evping.c \\|' | \
                                  sed -e 's|EVENT1_HDRS =\(.*\)|EVENT1_HDRS = include/evping.h \\|' | \
-                                 sed -e 's|SYS_LIBS =|SYS_LIBS = -lm|' > $EV_ROOT/Makefile.am
+                                 sed -e 's|SYS_LIBS =|SYS_LIBS = -lm -lrt -lpthread|' > $EV_ROOT/Makefile.am
   echo "Done"
 fi
 
@@ -49,14 +49,18 @@ if [ ! -f $EV_ROOT/include/include.am.ORG ]; then
 fi
 
 #
-# Add eping.c to sample/include.am
+# Add eping.c, epingbench.c and epinglog.c to sample/include.am
 #
 if [ ! -f $EV_ROOT/sample/include.am.ORG ]; then
   echo -n "Patching sample/include.am ... "
   mv $EV_ROOT/sample/include.am $EV_ROOT/sample/include.am.ORG
-  cat $EV_ROOT/sample/include.am.ORG | sed -e 's|SAMPLES =\(.*\)|SAMPLES = sample/eping \\|' > $EV_ROOT/sample/include.am
+  cat $EV_ROOT/sample/include.am.ORG | sed -e 's|SAMPLES =\(.*\)|SAMPLES = sample/eping sample/epingbench sample/epinglog \\|' > $EV_ROOT/sample/include.am
   echo "sample_eping_SOURCES = sample/eping.c" >> $EV_ROOT/sample/include.am
   echo "sample_eping_LDADD = \$(LIBEVENT_GC_SECTIONS) libevent.la" >> $EV_ROOT/sample/include.am
+  echo "sample_epingbench_SOURCES = sample/epingbench.c" >> $EV_ROOT/sample/include.am
+  echo "sample_epingbench_LDADD = \$(LIBEVENT_GC_SECTIONS) libevent_core.la -lm -lrt" >> $EV_ROOT/sample/include.am
+  echo "sample_epinglog_SOURCES = sample/epinglog.c" >> $EV_ROOT/sample/include.am
+  echo "sample_epinglog_LDADD = \$(LIBEVENT_GC_SECTIONS) libevent.la" >> $EV_ROOT/sample/include.am
   echo "Done"
 fi
 
@@ -80,6 +84,13 @@ if [ ! -f $EV_ROOT/include/event2/$file ]; then
   echo "Done"
 fi
 
+file=evping.hpp
+if [ ! -f $EV_ROOT/include/event2/$file ]; then
+  echo -n "Copying include $file to the libevent source tree ... "
+  cp $file $EV_ROOT/include/event2/
+  echo "Done"
+fi
+
 file=ping.h
 if [ ! -f $EV_ROOT/$file ]; then
   echo -n "Copying include $file to the libevent source tree ... "
@@ -94,6 +105,27 @@ if [ ! -f $EV_ROOT/sample/$file ]; then
   echo "Done"
 fi
 
+file=epingbench.c
+if [ ! -f $EV_ROOT/sample/$file ]; then
+  echo -n "Copying sample $file to the libevent source tree ... "
+  cp $file $EV_ROOT/sample/
+  echo "Done"
+fi
+
+file=epinglog.c
+if [ ! -f $EV_ROOT/sample/$file ]; then
+  echo -n "Copying sample $file to the libevent source tree ... "
+  cp $file $EV_ROOT/sample/
+  echo "Done"
+fi
+
+file=epingcoro.cc
+if [ ! -f $EV_ROOT/sample/$file ]; then
+  echo -n "Copying sample $file to the libevent source tree ... "
+  cp $file $EV_ROOT/sample/
+  echo "Done"
+fi
+
 if [ ! -f $EV_ROOT/README.md ]; then
   echo -n "Copying README.md to the libevent source tree ... "
   cp README.md $EV_ROOT/
@@ -29,19 +29,126 @@
 
 /* Operating System header file(s) */
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <signal.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
 /* Libevent header file(s) */
 #include "event2/event.h"
 #include "event2/evping.h"
 
 
+/* Default parameters */
+#define MAX_SOURCES 16                 /* # of sources which can be given on the command line */
+
+
 static struct event_base * base = NULL;
 static struct evping_base * ping = NULL;
 
+static int quiet = 0;                  /* Only print a summary at the end */
+static unsigned long replies = 0;      /* # of ICMP Echo Replies received */
+static unsigned long timeouts = 0;     /* # of ICMP Echo Requests timed out */
+static struct timeval started;         /* Time the pinging has begun */
+
+
+/* Upper bound of the bucket of a histogram which holds the given percentile */
+static unsigned long long percentile (struct evping_histogram * h, double p)
+{
+  ev_uint64_t seen = 0;
+  int i;
+
+  for (i = 0; i < EVPING_HIST_BUCKETS - 1; i ++)
+    if ((seen += h->buckets [i]) >= p * h->count)
+      break;
+  return i ? 1ULL << i : 0;
+}
+
+
+/* Print a histogram on a single line */
+static void print_histogram (char * name, struct evping_histogram * h, char * unit)
+{
+  printf ("%s avg/p99/max = %.1f/<%llu/%llu %s\n", name,
+	  h->count ? (double) h->sum / h->count : 0.0, percentile (h, 0.99), (unsigned long long) h->max, unit);
+}
+
+
+/* Print the number of probes completed per second and the CPU time spent for each of them */
+static void summary (void)
+{
+  struct evping_base_stats stats;
+  struct evping_group_stats group;
+  struct evping_source_stats source;
+  struct timeval now;
+  struct rusage usage;
+  double elapsed;
+  double cpu;
+  unsigned long probes = replies + timeouts;
+  int i;
+
+  gettimeofday (&now, NULL);
+  getrusage (RUSAGE_SELF, &usage);
+
+  elapsed = (now.tv_sec - started.tv_sec) + (now.tv_usec - started.tv_usec) / 1000000.0;
+  cpu = usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+
+  printf ("%lu probes (%lu replies, %lu timeouts) in %.3f secs, %.0f pps, %.3f usecs CPU/probe\n",
+	  probes, replies, timeouts, elapsed, elapsed > 0 ? probes / elapsed : 0.0,
+	  probes ? cpu * 1000000.0 / probes : 0.0);
+
+  /* Where the time went */
+  evping_base_get_stats (ping, & stats);
+  print_histogram ("timer lateness", & stats.timer_lateness, "usecs");
+  print_histogram ("reply delay", & stats.reply_delay, "usecs");
+  print_histogram ("receive queue", & stats.rx_queue, "bytes");
+  printf ("kernel drops %llu, rcvbuf %d bytes, sndbuf %d bytes\n",
+	  (unsigned long long) stats.kernel_drops, stats.rcvbuf, stats.sndbuf);
+
+  /* The ranges */
+  if (stats.targets)
+    printf ("%llu addresses (%llu responders), %.1f bytes/address, %llu sweeps, last in %.3f ms\n",
+	    (unsigned long long) stats.targets, (unsigned long long) stats.responders,
+	    (double) stats.range_memory / stats.targets, (unsigned long long) stats.sweeps,
+	    stats.sweep_time / 1000.0);
+
+  /* The probe log */
+  if (stats.log_records || stats.log_drops)
+    printf ("%llu records logged, %llu lost\n",
+	    (unsigned long long) stats.log_records, (unsigned long long) stats.log_drops);
+
+  /* The groups */
+  for (i = 0; evping_group_get_stats (ping, i, & group) == 0; i ++)
+    {
+      printf ("group %s: %u hosts (%u losing), loss %.1f%% (last 16/64 %.1f%%/%.1f%%), ",
+	      group.name, group.hosts, group.losing, group.loss, group.loss_16, group.loss_64);
+      print_histogram ("rtt", & group.rtt, "usecs");
+    }
+
+  /* The sources */
+  for (i = 0; evping_source_get_stats (ping, i, & source) == 0; i ++)
+    printf ("source %s: %u hosts, %llu sent (%llu failed), %llu read, %llu replies, kernel drops %llu\n",
+	    source.name, source.hosts, (unsigned long long) source.sentok, (unsigned long long) source.sendfail,
+	    (unsigned long long) source.recvok, (unsigned long long) source.replies,
+	    (unsigned long long) source.kernel_drops);
+}
+
+
+/* Print the statistics at the execution end, the reverse names of the addresses of the ranges are looked up first */
+static void results (void)
+{
+  if (quiet)
+    summary ();
+  else
+    {
+      evping_base_resolve (ping);
+      evping_stats (ping);
+    }
+}
+
 
 /* What should be done when the program execution is interrupted by a signal */
 static void on_signal (int sig)
@@ -49,13 +156,30 @@ static void on_signal (int sig)
   printf ("\n");
 
   /* Print statistics at the execution end */
-  evping_stats (ping);
+  results ();
 
   /* Immediately exit the event loop */
   event_base_loopbreak (base);
 }
 
 
+/* Callback when all the hosts have been pinged the given number of times, or the capture has been replayed */
+static void done (struct evping_base * ping, void * arg)
+{
+  struct timeval now;
+
+  gettimeofday (&now, NULL);
+
+  /* Print statistics at the execution end */
+  printf ("\n");
+  results ();
+  printf ("%s completed in %.3f secs\n", (char *) arg,
+	  (now.tv_sec - started.tv_sec) + (now.tv_usec - started.tv_usec) / 1000000.0);
+
+  event_base_loopbreak (base);
+}
+
+
 /* Callback when a PING request for a given host has been completed/elapsed */
 static void callback (int result, int bytes, char * fqname, char * dotname,
 		      int seq, int ttl, struct timeval * elapsed, void * arg)
@@ -63,13 +187,17 @@ static void callback (int result, int bytes, char * fqname, char * dotname,
   switch (result)
     {
     case PING_ERR_NONE:
-      printf ("%d bytes from %s (%s): icmp_seq=%d ttl=%d time=%ld ms\n",
-	      bytes, fqname, dotname, seq, ttl, tvtousecs (elapsed) / 1000);
+      replies ++;
+      if (! quiet)
+        printf ("%d bytes from %s (%s): icmp_seq=%d ttl=%d time=%ld ms\n",
+		bytes, fqname, dotname, seq, ttl, tvtousecs (elapsed) / 1000);
       break;
 
     case PING_ERR_TIMEOUT:
-      printf ("time out with %s (%s): icmp_seq=%d time=%ld ms\n",
-	      fqname, dotname, seq, tvtousecs (elapsed) / 1000);
+      timeouts ++;
+      if (! quiet)
+        printf ("time out with %s (%s): icmp_seq=%d time=%ld ms\n",
+		fqname, dotname, seq, tvtousecs (elapsed) / 1000);
       break;
 
     default:
@@ -78,13 +206,88 @@ static void callback (int result, int bytes, char * fqname, char * dotname,
 }
 
 
+/* How to use this program */
+static void usage (char * progname)
+{
+  printf ("Usage: %s [-c count] [-w file] [-l prefix] [-R file [-p]] [-V secs [-L percent]] [-i msecs] [-t msecs] [-b msecs] [-z] [-s bytes] [-q] [-u] [-r iface] [-m name] [-S source ...] [group:]host|prefix/len [...]\n", progname);
+  printf ("  -c count   stop after sending count requests to each host\n");
+  printf ("  -w file    record the packets received to file in the pcap format\n");
+  printf ("  -l prefix  log the outcome of each probe to the segment files prefix.NNNNNN (see epinglog)\n");
+  printf ("  -R file    replay the packets recorded to file as fast as possible, hosts are optional\n");
+  printf ("  -p         replay at the original pace\n");
+  printf ("  -V secs    simulate secs of probing on a virtual clock, nothing is sent and replies come in 1 ms\n");
+  printf ("  -L percent lose percent of the requests in the simulation\n");
+  printf ("  -i msecs   interval between two subsequent pings of the same host (0 means flood)\n");
+  printf ("  -t msecs   time to wait for a response\n");
+  printf ("  -b msecs   back off hosts not replying, doubling their interval up to msecs\n");
+  printf ("  -z         send compact probes, with no data bytes unless -s is given\n");
+  printf ("  -s bytes   number of data bytes to be sent\n");
+  printf ("  -q         quiet, only print the number of probes per second and the CPU time per probe\n");
+  printf ("  -u         transmit and receive via io_uring (Linux only)\n");
+  printf ("  -r iface   receive the replies from a memory-mapped packet ring on iface (Linux only)\n");
+  printf ("  -m name    publish the most recent samples of each host to the shared memory object name\n");
+  printf ("  -S source  probe each host from an interface or a source address (may be repeated up to %d times)\n", MAX_SOURCES);
+}
+
+
 /* Sirs and Ladies, here to you... eping!!! */
 int main (int argc, char * argv [])
 {
   /* Notice the program name */
   char * progname = strrchr (argv [0], '/');
+  char * interval = NULL;
+  char * timeout = NULL;
+  char * backoff = NULL;
+  char * size = NULL;
+  char * ring = NULL;
+  char * shm = NULL;
+  int uring = 0;
+  int compact = 0;
+  char * sources [MAX_SOURCES];
+  int nsources = 0;
+  int count = 0;
+  char * record = NULL;
+  char * log = NULL;
+  char * replay = NULL;
+  int paced = 0;
+  int simulate = 0;
+  char * loss = NULL;
+  int option;
   progname = ! progname ? * argv : progname + 1;
 
+  /* Parse command line options */
+  while ((option = getopt (argc, argv, "c:w:l:R:pV:L:i:t:b:zs:qur:m:S:")) != -1)
+    switch (option)
+      {
+      case 'c': count = atoi (optarg); break;
+      case 'w': record = optarg;   break;
+      case 'l': log = optarg;      break;
+      case 'R': replay = optarg;   break;
+      case 'p': paced = 1;         break;
+      case 'V': simulate = atoi (optarg); break;
+      case 'L': loss = optarg;     break;
+      case 'i': interval = optarg; break;
+      case 't': timeout = optarg;  break;
+      case 'b': backoff = optarg;  break;
+      case 'z': compact = 1;       break;
+      case 's': size = optarg;     break;
+      case 'q': quiet = 1;         break;
+      case 'u': uring = 1;         break;
+      case 'r': ring = optarg;     break;
+      case 'm': shm = optarg;      break;
+      case 'S':
+	if (nsources == MAX_SOURCES)
+	  {
+	    usage (progname);
+	    return 1;
+	  }
+	sources [nsources ++] = optarg;
+	break;
+      default:
+	usage (progname);
+	return 1;
+      }
+
   /* Set unbuffered stdout */
   setvbuf (stdout, NULL, _IONBF, 0);
 
@@ -93,40 +296,124 @@ int main (int argc, char * argv [])
   signal (SIGTERM, on_signal);         /* terminate */
 
   /* Move pointer to arguments (if any) passed on the command line */
-  argv ++;
+  argv += optind;
 
   /* Check for at least one mandatory parameter */
-  if (! argv || ! * argv)
+  if ((! argv || ! * argv) && ! replay)
     printf ("%s: missing argument(s)\n", progname);
   else
     {
       /* Initialize the Libevent with a new main base */
       base = event_base_new ();
 
-      /* Initialize the PING library */
-      ping = evping_base_new (base);
-      if (! ping)
+      /* Initialize the PING library, with no raw socket when simulating so that super-user permissions are not needed */
+      ping = evping_base_new_with_flags (base, simulate > 0 ? EVPING_BASE_NO_SOCKET : 0);
+      if (! ping && simulate > 0)
+	printf ("%s: cannot initialize the PING library\n", progname);
+      else if (! ping)
 	printf ("sorry, it can only be run by root, or it must be setuid root\n");
       else
 	{
+	  struct evping_base_stats stats;
 	  unsigned n = 0;
+	  int i;
+
+	  /* Apply the command line options, compact first since it allows sizes below the minimum */
+	  if ((simulate > 0 && evping_base_set_option (ping, "simulate:", "1") == -1) ||
+	      (simulate > 0 && loss && evping_base_set_option (ping, "sim-loss:", loss) == -1) ||
+	      (compact && evping_base_set_option (ping, "compact:", "1") == -1) ||
+	      (interval && evping_base_set_option (ping, "interval:", interval) == -1) ||
+	      (timeout && evping_base_set_option (ping, "timeout:", timeout) == -1) ||
+	      (backoff && evping_base_set_option (ping, "backoff:", backoff) == -1) ||
+	      (size && evping_base_set_option (ping, "size:", size) == -1) ||
+	      (ring && evping_base_set_option (ping, "packet-ring:", ring) == -1) ||
+	      (shm && evping_base_set_option (ping, "shm:", shm) == -1) ||
+	      (record && evping_base_set_option (ping, "pcap:", record) == -1) ||
+	      (log && evping_base_set_option (ping, "log:", log) == -1))
+	    {
+	      printf ("%s: illegal option value\n", progname);
+	      evping_base_free (ping, 0);
+	      event_base_free (base);
+	      return 1;
+	    }
+	  evping_base_set_option (ping, "quiet:", quiet ? "1" : "0");
+	  evping_base_set_option (ping, "io-uring:", uring ? "1" : "0");
+
+	  /* The sources to probe the hosts from */
+	  for (i = 0; i < nsources; i ++)
+	    if (evping_base_source_add (ping, sources [i]) == -1)
+	      printf ("%s: cannot probe from %s\n", progname, sources [i]);
 
 	  /* Process all the command line arguments */
 	  while (argv && * argv)
 	    {
-	      /* One more host to ping */
-	      evping_base_host_add (ping, * argv);
+	      /* One more host, or range of addresses in CIDR notation, to ping */
+	      if (strchr (* argv, '/'))
+		{
+		  if (evping_base_range_add (ping, * argv) == -1)
+		    printf ("%s: illegal range %s\n", progname, * argv);
+		}
+	      else
+		{
+		  /* One more host, optionally tagged with a group, probed from each source (if any) */
+		  char * colon = strchr (* argv, ':');
+		  char * name = * argv;
+		  int group = -1;
+
+		  if (colon)
+		    {
+		      * colon = '\0';
+		      group = evping_base_group_add (ping, * argv);
+		      name = colon + 1;
+		    }
+		  if (evping_host_add (ping, name, group, evping_base_count_sources (ping) ? EVPING_SOURCE_ALL : -1) == -1)
+		    printf ("%s: cannot add %s\n", progname, name);
+		}
 	      argv ++;
 	      n ++;
 	    }
 
 	  printf ("#%d host%s being pinged\n", evping_base_count_hosts (ping), n > 1 ? "s" : "");
+	  evping_base_get_stats (ping, & stats);
+	  if (stats.targets)
+	    printf ("#%llu addresses being swept\n", (unsigned long long) stats.targets);
 
 	  /* Begin sending ICMP ECHO_REQUEST to network hosts */
-	  evping_ping (ping, callback, NULL);
+	  gettimeofday (&started, NULL);
+	  if (replay)
+	    {
+	      if (evping_base_replay (ping, replay, paced, callback, done, "replay") == -1)
+		{
+		  printf ("%s: cannot replay %s\n", progname, replay);
+		  evping_base_free (ping, 0);
+		  event_base_free (base);
+		  return 1;
+		}
+	    }
+	  else if (count > 0)
+	    evping_sweep (ping, count, callback, done, "sweep");
+	  else
+	    evping_ping (ping, callback, NULL);
 
-	  /* Event dispatching loop */
-	  event_base_dispatch (base);
+	  if (simulate > 0)
+	    {
+	      /* Hours of probing go by on the virtual clock, the summary is printed here unless done earlier */
+	      struct timeval tv = { simulate, 0 };
+	      struct timeval now;
+
+	      evping_simulate (ping, & tv);
+	      gettimeofday (&now, NULL);
+	      if (count <= 0 && ! replay)
+		{
+		  printf ("\n");
+		  results ();
+		}
+	      printf ("%d secs simulated in %.3f secs\n", simulate,
+		      (now.tv_sec - started.tv_sec) + (now.tv_usec - started.tv_usec) / 1000000.0);
+	    }
+	  else
+	    /* Event dispatching loop */
+	    event_base_dispatch (base);
 	}
     }
 
@@ -0,0 +1,404 @@
+/*
+ * epingbench.c - microbenchmarks of the evping hot paths
+ *
+ * Copyright (c) 2009-2016 Rocco Carbone <rocco@tecsiel.it>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * The internals of the ping protocol are measured directly, so the implementation
+ * is compiled in here rather than linked (this program is linked to libevent_core,
+ * which does not contain it).  No packet is sent over the wire and super-user
+ * permissions are not required.
+ *
+ * Results are printed one per line as JSON objects:
+ *   {"benchmark":"reply","hosts":100,"size":68,"ops":4194304,"ns_per_op":31.25}
+ * where 'size' is the number of data bytes (0 when not relevant).
+ */
+#include "evping.c"
+
+/* Operating System header file(s) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <time.h>
+
+
+/* Default parameters */
+#define DEFAULT_BUDGET 200                     /* msecs spent for each measurement */
+
+static unsigned default_hosts [] = { 1, 100, 10000, 0 };
+static unsigned default_sizes [] = { MIN_DATA_SIZE, DEFAULT_DATA_SIZE, 1472, 0 };
+
+
+/* What a benchmark is given to run 'n' operations */
+struct bench {
+  struct evping_base * base;
+  struct evhost ** hosts;              /* The hosts in the order they have been added */
+  unsigned nhosts;
+  u_char * packet;
+  unsigned size;                       /* ICMP data bytes */
+};
+
+typedef void (* bench_fn) (struct bench * b, unsigned long n);
+
+static volatile unsigned long sink;    /* keep the compiler from discarding results */
+static unsigned budget = DEFAULT_BUDGET;
+
+
+/* Monotonic time in nanoseconds */
+static double nsecs (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, & ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+
+/* Run 'fn' with an increasing number of operations until the budget is spent and print the result */
+static void measure (char * name, bench_fn fn, struct bench * b, unsigned hosts, unsigned size)
+{
+  unsigned long n = 1;
+  double elapsed;
+
+  for (;;)
+    {
+      double t0 = nsecs ();
+      fn (b, n);
+      elapsed = nsecs () - t0;
+      if (elapsed >= budget * 1e6 || n >= (1UL << 40))
+	break;
+      n *= 2;
+    }
+
+  printf ("{\"benchmark\":\"%s\",\"hosts\":%u,\"size\":%u,\"ops\":%lu,\"ns_per_op\":%.2f}\n",
+	  name, hosts, size, n, elapsed / n);
+}
+
+
+/* A base which has no raw socket, with 'n' hosts in 10.0.0.0/8 (not resolved) */
+static struct evping_base * bench_base (struct event_base * evbase, unsigned n)
+{
+  struct evping_base * base = evping_base_new_with_flags (evbase, EVPING_BASE_NO_SOCKET);
+  unsigned i;
+
+  evping_base_set_option (base, "quiet:", "1");
+
+  EVPING_LOCK (base);
+  for (i = 0; i < n; i ++)
+    {
+      struct in_addr addr;
+      addr.s_addr = htonl (0x0a000001 + i);
+      evhost_new (base, inet_ntoa (addr), addr, inet_ntoa (addr));
+    }
+  EVPING_UNLOCK (base);
+
+  return base;
+}
+
+
+/* Internet checksum of an ICMP Echo Request */
+static void bench_mkcksum (struct bench * b, unsigned long n)
+{
+  unsigned long i;
+  for (i = 0; i < n; i ++)
+    sink += mkcksum ((u_short *) b->packet, ICMP_MINLEN + b->size);
+}
+
+
+/* Formatting of an ICMP Echo Request (it includes the timestamp and the checksum) */
+static void bench_fmticmp (struct bench * b, unsigned long n)
+{
+  struct timeval now;
+  unsigned long i;
+  for (i = 0; i < n; i ++)
+    {
+      gettimeofday (& now, NULL);
+      fmticmp (b->packet, ICMP_MINLEN + b->size, i, i % b->nhosts, b->base->pid, & now);
+    }
+  sink += b->packet [2];
+}
+
+
+/*
+ * Decoding of an ICMP Echo Reply and accounting, with replies spread over all the hosts
+ * (each one to the request outstanding for its host, whose no reply timer is armed as at send time)
+ */
+static void bench_reply (struct bench * b, unsigned long n)
+{
+  struct ip * ip = (struct ip *) b->packet;
+  struct icmphdr * icmp = (struct icmphdr *) (b->packet + IPHDR);
+  struct evdata * data = (struct evdata *) (b->packet + IPHDR + ICMP_MINLEN);
+  struct timeval now;
+  unsigned long i;
+
+  memset (b->packet, 0, IPHDR + ICMP_MINLEN + b->size);
+  ip->ip_v = 4;
+  ip->ip_hl = IPHDR / 4;
+  ip->ip_ttl = 64;
+  ip->ip_p = IPPROTO_ICMP;
+  icmp->type = ICMP_ECHOREPLY;
+  icmp->un.echo.id = 0xffff & b->base->pid;
+  gettimeofday (& data->ts, NULL);
+
+  EVPING_LOCK (b->base);
+  for (i = 0; i < n; i ++)
+    {
+      struct evhost * host = b->hosts [i % b->nhosts];
+      evping_timer_add (b->base, & host->noreply_timer, & b->base->tv_noreply);
+      icmp->un.echo.sequence = htons (host->seq);
+      data->index = host->index;
+      gettimeofday (& now, NULL);
+      evping_reply (b->base, NULL, b->packet, IPHDR + ICMP_MINLEN + b->size, & now);
+    }
+  EVPING_UNLOCK (b->base);
+}
+
+
+/* Lookup of the host a reply refers to, spread over all the hosts */
+static void bench_lookup (struct bench * b, unsigned long n)
+{
+  unsigned long i;
+  for (i = 0; i < n; i ++)
+    sink += (unsigned long) evping_lookup_host (b->base, (i * 2654435761UL) % b->nhosts);
+}
+
+
+/* Timers operations for each probe: the no reply timer armed at send time, then cleared and the ping timer armed at reply time */
+static void bench_rearm (struct bench * b, unsigned long n)
+{
+  unsigned long i;
+  for (i = 0; i < n; i ++)
+    {
+      struct evhost * host = b->hosts [i % b->nhosts];
+      evping_timer_add (b->base, & host->noreply_timer, & b->base->tv_noreply);
+      evping_timer_del (b->base, & host->noreply_timer);
+      evping_timer_add (b->base, & host->ping_timer, & b->base->tv_interval);
+    }
+}
+
+
+/* Aggregation of the statistics of all the hosts (the output is discarded) */
+static void bench_stats (struct bench * b, unsigned long n)
+{
+  unsigned long i;
+  int saved;
+  int null;
+
+  fflush (stdout);
+  saved = dup (1);
+  null = open ("/dev/null", O_WRONLY);
+  dup2 (null, 1);
+
+  for (i = 0; i < n; i ++)
+    evping_stats (b->base);
+
+  fflush (stdout);
+  dup2 (saved, 1);
+  close (saved);
+  close (null);
+}
+
+
+/* Decoding and accounting of the packets of a capture, looping over it */
+static void bench_replay (struct bench * b, unsigned long n)
+{
+  unsigned long i;
+
+  EVPING_LOCK (b->base);
+  for (i = 0; i < n; i ++)
+    if (replay_one (b->base, b->base->replay) == -1)
+      {
+	b->base->replay->off = sizeof (struct pcap_file_header);
+	replay_one (b->base, b->base->replay);
+      }
+  EVPING_UNLOCK (b->base);
+}
+
+
+/*
+ * Probing of all the hosts for 'secs' on the virtual clock, against a simulated responder
+ * which loses some requests and has some dead hosts so that the timeouts are taken as well
+ */
+static void simulate (struct event_base * evbase, unsigned nhosts, unsigned secs)
+{
+  struct evping_base * base = bench_base (evbase, nhosts);
+  struct timeval tv = { secs, 0 };
+  unsigned long probes = 0;
+  double elapsed;
+  double t0;
+  unsigned i;
+
+  evping_base_set_option (base, "simulate:", "1");
+  evping_base_set_option (base, "sim-jitter:", "500");
+  evping_base_set_option (base, "sim-loss:", "1");
+  evping_base_set_option (base, "sim-dead:", "1");
+  evping_ping (base, NULL, NULL);
+
+  t0 = nsecs ();
+  evping_simulate (base, & tv);
+  elapsed = nsecs () - t0;
+
+  for (i = 0; i < nhosts; i ++)
+    probes += base->hosts [i]->recvpkts + base->hosts [i]->dropped;
+
+  printf ("{\"benchmark\":\"simulate\",\"hosts\":%u,\"size\":0,\"ops\":%lu,\"ns_per_op\":%.2f,\"timers\":%llu,\"speedup\":%.1f}\n",
+	  nhosts, probes, probes ? elapsed / probes : 0.0, (unsigned long long) base->sim->timers, secs * 1e9 / elapsed);
+
+  evping_base_free (base, 0);
+}
+
+
+/* Parse a comma separated list of numbers */
+static unsigned * parse_list (char * arg)
+{
+  unsigned * list = calloc (strlen (arg) + 2, sizeof (unsigned));
+  unsigned n = 0;
+  char * token;
+
+  for (token = strtok (arg, ","); token; token = strtok (NULL, ","))
+    if (atoi (token) > 0)
+      list [n ++] = atoi (token);
+  return list;
+}
+
+
+/* How to use this program */
+static void usage (char * progname)
+{
+  printf ("Usage: %s [-t msecs] [-n hosts,...] [-s bytes,...] [-r file] [-V secs]\n", progname);
+  printf ("  -t msecs        time spent for each measurement (default %d)\n", DEFAULT_BUDGET);
+  printf ("  -n hosts,...    number of hosts (default 1,100,10000)\n");
+  printf ("  -s bytes,...    number of data bytes (default %u,%u,1472)\n", (unsigned) MIN_DATA_SIZE, (unsigned) DEFAULT_DATA_SIZE);
+  printf ("  -r file         only replay the packets recorded to file (see the pcap option)\n");
+  printf ("  -V secs         only simulate secs of probing of each number of hosts on the virtual clock\n");
+}
+
+
+int main (int argc, char * argv [])
+{
+  /* Notice the program name */
+  char * progname = strrchr (argv [0], '/');
+  unsigned * hosts = default_hosts;
+  unsigned * sizes = default_sizes;
+  char * capture = NULL;
+  unsigned secs = 0;
+  struct event_base * evbase;
+  struct bench b;
+  unsigned * h;
+  unsigned * s;
+  int option;
+  progname = ! progname ? * argv : progname + 1;
+
+  /* Parse command line options */
+  while ((option = getopt (argc, argv, "t:n:s:r:V:")) != -1)
+    switch (option)
+      {
+      case 't': budget = atoi (optarg); break;
+      case 'n': hosts = parse_list (optarg); break;
+      case 's': sizes = parse_list (optarg); break;
+      case 'r': capture = optarg; break;
+      case 'V': secs = atoi (optarg); break;
+      default:
+	usage (progname);
+	return 1;
+      }
+
+  for (s = sizes; * s; s ++)
+    if (* s < MIN_DATA_SIZE || * s > MAX_DATA_SIZE)
+      {
+	printf ("%s: data size must be in the range %u-%u\n", progname, (unsigned) MIN_DATA_SIZE, (unsigned) MAX_DATA_SIZE);
+	return 1;
+      }
+
+  evbase = event_base_new ();
+  memset (& b, 0, sizeof (b));
+  b.packet = calloc (1, IP_MAXPACKET);
+
+  /* A capture replayed through the receive path, with the hosts it refers to */
+  if (capture)
+    {
+      b.base = bench_base (evbase, 0);
+      EVPING_LOCK (b.base);
+      b.base->replay = replay_new (b.base, capture);
+      EVPING_UNLOCK (b.base);
+      if (! b.base->replay)
+	{
+	  printf ("%s: cannot replay %s\n", progname, capture);
+	  return 1;
+	}
+      measure ("replay", bench_replay, & b, b.base->argc, 0);
+      evping_base_free (b.base, 0);
+      event_base_free (evbase);
+      return 0;
+    }
+
+  /* Hours of probing of each number of hosts in seconds */
+  if (secs)
+    {
+      for (h = hosts; * h; h ++)
+	simulate (evbase, * h, secs);
+      event_base_free (evbase);
+      return 0;
+    }
+
+  /* Per packet operations (the number of hosts is not relevant) */
+  b.base = bench_base (evbase, 1);
+  b.hosts = b.base->hosts;
+  b.nhosts = 1;
+  for (s = sizes; * s; s ++)
+    {
+      b.size = * s;
+      measure ("mkcksum", bench_mkcksum, & b, 0, b.size);
+      measure ("fmticmp", bench_fmticmp, & b, 0, b.size);
+    }
+  evping_base_free (b.base, 0);
+
+  /* Per host operations */
+  for (h = hosts; * h; h ++)
+    {
+      b.base = bench_base (evbase, * h);
+      b.hosts = b.base->hosts;
+      b.nhosts = * h;
+
+      for (s = sizes; * s; s ++)
+	{
+	  b.size = * s;
+	  b.base->pktsize = ICMP_MINLEN + b.size;
+	  measure ("reply", bench_reply, & b, b.nhosts, b.size);
+	}
+
+      measure ("lookup", bench_lookup, & b, b.nhosts, 0);
+      measure ("rearm", bench_rearm, & b, b.nhosts, 0);
+      measure ("stats", bench_stats, & b, b.nhosts, 0);
+
+      evping_base_free (b.base, 0);
+    }
+
+  free (b.packet);
+  event_base_free (evbase);
+
+  return 0;
+}
@@ -0,0 +1,243 @@
+/*
+ * epingcoro.cc - the cost of the C++20 coroutines over the raw callbacks
+ *
+ * Copyright (c) 2009-2016 Rocco Carbone <rocco@tecsiel.it>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+/*
+ * Each host is probed again as soon as its previous probe is completed/elapsed,
+ * first from the C callback and then from a coroutine, for the same amount of time.
+ * The targets should be local (for instance 127.0.0.1 ... 127.0.0.64) to measure
+ * the process rather than the network.
+ *
+ * Results are printed one per line as JSON objects:
+ *   {"benchmark":"coroutine","hosts":64,"probes":1048576,"pps":104857,"cpu_ns_per_probe":9536.74}
+ */
+
+/* Operating System header file(s) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+/* Libevent header file(s) */
+#include "event2/event.h"
+#include "event2/evping.hpp"
+
+
+/* Default parameters */
+#define DEFAULT_DURATION 5                     /* secs spent for each measurement */
+
+
+static struct event_base * base = NULL;
+static unsigned long probes = 0;       /* # of probes completed */
+static int running = 0;                /* # of hosts still being probed */
+static int stopping = 0;               /* Set when the time is over */
+
+
+/* CPU time spent by the process so far in seconds */
+static double cputime (void)
+{
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, & usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000000.0;
+}
+
+
+/* Wall clock time in seconds */
+static double walltime (void)
+{
+  struct timeval now;
+  gettimeofday (& now, NULL);
+  return now.tv_sec + now.tv_usec / 1000000.0;
+}
+
+
+/* No more probes once the time is over */
+static void on_time (evutil_socket_t fd, short event, void * arg)
+{
+  stopping = 1;
+}
+
+
+/* One less host being probed */
+static void done (void)
+{
+  if (! -- running)
+    event_base_loopbreak (base);
+}
+
+
+/* Run the loop for 'duration' secs and print the results */
+static void measure (const char * name, int hosts, int duration)
+{
+  struct timeval tv = { duration, 0 };
+  double t0 = walltime ();
+  double c0 = cputime ();
+  double elapsed;
+
+  event_base_once (base, -1, EV_TIMEOUT, on_time, NULL, & tv);
+  event_base_dispatch (base);
+
+  elapsed = walltime () - t0;
+  printf ("{\"benchmark\":\"%s\",\"hosts\":%d,\"probes\":%lu,\"pps\":%.0f,\"cpu_ns_per_probe\":%.2f}\n",
+	  name, hosts, probes, probes / elapsed, probes ? (cputime () - c0) * 1e9 / probes : 0.0);
+}
+
+
+/* What the C callback needs to probe its host again */
+struct closure {
+  struct evping_base * ping;
+  int host;
+};
+
+
+/* Callback when a PING request for a given host has been completed/elapsed, the host is probed again */
+static void again (int result, int bytes, char * fqname, char * dotname,
+		   int seq, int ttl, struct timeval * elapsed, void * arg)
+{
+  struct closure * c = (struct closure *) arg;
+
+  probes ++;
+  if (stopping || evping_host_probe (c->ping, c->host, again, c) == -1)
+    done ();
+}
+
+
+/* Probe a host again and again from a coroutine */
+static evping::task watch (evping::pinger & p, evping::host h)
+{
+  while (! stopping)
+    {
+      evping::result r = co_await p.probe (h);
+      if (r.error == PING_ERR_UNKNOWN)
+	break;
+      probes ++;
+    }
+  done ();
+}
+
+
+/* How to use this program */
+static void usage (char * progname)
+{
+  printf ("Usage: %s [-d secs] host ...\n", progname);
+  printf ("  -d secs         time spent for each measurement (default %d)\n", DEFAULT_DURATION);
+}
+
+
+int main (int argc, char * argv [])
+{
+  /* Notice the program name */
+  char * progname = strrchr (argv [0], '/');
+  int duration = DEFAULT_DURATION;
+  int option;
+  int hosts;
+  int i;
+  progname = ! progname ? * argv : progname + 1;
+
+  /* Parse command line options */
+  while ((option = getopt (argc, argv, "d:")) != -1)
+    switch (option)
+      {
+      case 'd': duration = atoi (optarg); break;
+      default:
+	usage (progname);
+	return 1;
+      }
+  argc -= optind;
+  argv += optind;
+
+  if (! argc)
+    {
+      usage (progname);
+      return 1;
+    }
+
+  base = event_base_new ();
+
+  try
+    {
+      /* The raw C callbacks */
+      {
+	struct evping_base * ping = evping_base_new (base);
+	struct closure * closures = (struct closure *) calloc (argc, sizeof (struct closure));
+
+	if (! ping)
+	  {
+	    printf ("%s: cannot create the ping base\n", progname);
+	    return 1;
+	  }
+
+	evping_base_set_option (ping, "quiet:", "1");
+	for (i = 0; i < argc; i ++)
+	  evping_base_host_add (ping, argv [i]);
+	hosts = evping_base_count_hosts (ping);
+
+	probes = 0;
+	stopping = 0;
+	running = hosts;
+	for (i = 0; i < hosts; i ++)
+	  {
+	    closures [i].ping = ping;
+	    closures [i].host = i;
+	    evping_host_probe (ping, i, again, & closures [i]);
+	  }
+	measure ("callback", hosts, duration);
+
+	evping_base_free (ping, 0);
+	free (closures);
+      }
+
+      /* The coroutines */
+      {
+	evping::pinger p (base);
+
+	p.set_option ("quiet:", "1");
+	for (i = 0; i < argc; i ++)
+	  p.add (argv [i]);
+	hosts = evping_base_count_hosts (p.get ());
+
+	probes = 0;
+	stopping = 0;
+	running = hosts;
+	for (i = 0; i < hosts; i ++)
+	  watch (p, p.lookup (i));
+	measure ("coroutine", hosts, duration);
+      }
+    }
+  catch (const std::exception & e)
+    {
+      printf ("%s: %s\n", progname, e.what ());
+      return 1;
+    }
+
+  event_base_free (base);
+
+  return 0;
+}
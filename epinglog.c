@@ -0,0 +1,208 @@
+/*
+ * epinglog.c - scan the segment files of the probe log written by evping
+ *
+ * Copyright (c) 2009-2016 Rocco Carbone <rocco@tecsiel.it>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+
+/*
+ * The segments are mapped in memory and read sequentially, records not
+ * matching the filters are skipped without being formatted, so the scan
+ * runs at the speed the disk (or the page cache) delivers them.
+ *
+ *   epinglog -s -h 3 -r 1 /var/tmp/probes.*
+ */
+
+/* Operating System header file(s) */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Libevent header file(s) */
+#include "event2/event.h"
+#include "event2/evping.h"
+
+
+/* What the records are filtered by */
+static long host = -1;                 /* Only this host, -1 = all */
+static int result = -1;                /* Only this result, -1 = all */
+static ev_uint64_t from = 0;           /* Not before this time (nsecs since the Epoch) */
+static ev_uint64_t to = ~0ULL;         /* Not after this time (nsecs since the Epoch) */
+static int summary = 0;                /* Only print a summary */
+
+/* What the summary is made of */
+static unsigned long long records = 0;
+static unsigned long long replies = 0;
+static unsigned long long timeouts = 0;
+static ev_uint64_t rtt_min = ~0ULL;
+static ev_uint64_t rtt_max = 0;
+static double rtt_sum = 0;
+
+
+/* Seconds since the Epoch, with decimals, to nsecs */
+static ev_uint64_t nsecs (char * secs)
+{
+  return strtod (secs, NULL) * 1e9;
+}
+
+
+/* Print a record on a single line */
+static void print_record (struct evping_log_record * rec)
+{
+  printf ("%llu.%09llu host %u seq %u %s ttl %u rtt %.3f ms\n",
+	  (unsigned long long) (rec->ts / 1000000000ULL), (unsigned long long) (rec->ts % 1000000000ULL),
+	  rec->host, rec->seq, rec->result == PING_ERR_NONE ? "reply" : "timeout", rec->ttl, rec->rtt / 1e6);
+}
+
+
+/* Scan a segment file, return -1 in the event of error */
+static int scan (char * name)
+{
+  struct evping_log_header * hdr;
+  struct stat st;
+  ev_uint64_t size;
+  ev_uint64_t count;
+  ev_uint64_t i;
+  int fd;
+
+  if ((fd = open (name, O_RDONLY)) == -1 || fstat (fd, & st) == -1 || st.st_size < (off_t) sizeof (* hdr))
+    {
+      if (fd != -1)
+	close (fd);
+      return -1;
+    }
+
+  hdr = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (hdr == MAP_FAILED)
+    return -1;
+
+  size = st.st_size;
+  if (hdr->magic != EVPING_LOG_MAGIC || hdr->version != EVPING_LOG_VERSION ||
+      hdr->hdr_size < sizeof (* hdr) || hdr->hdr_size > size ||
+      hdr->record_size < sizeof (struct evping_log_record))
+    {
+      munmap (hdr, st.st_size);
+      return -1;
+    }
+  madvise (hdr, st.st_size, MADV_SEQUENTIAL);
+
+  /* The segment may still be written, or truncated to the records it holds */
+  count = __atomic_load_n (& hdr->count, __ATOMIC_ACQUIRE);
+  if (count > (size - hdr->hdr_size) / hdr->record_size)
+    count = (size - hdr->hdr_size) / hdr->record_size;
+
+  for (i = 0; i < count; i ++)
+    {
+      struct evping_log_record * rec = EVPING_LOG_RECORD (hdr, i);
+
+      if ((host != -1 && rec->host != host) || (result != -1 && rec->result != result) ||
+	  rec->ts < from || rec->ts > to)
+	continue;
+
+      records ++;
+      if (rec->result == PING_ERR_NONE)
+	{
+	  replies ++;
+	  rtt_sum += rec->rtt;
+	  if (rec->rtt < rtt_min)
+	    rtt_min = rec->rtt;
+	  if (rec->rtt > rtt_max)
+	    rtt_max = rec->rtt;
+	}
+      else
+	timeouts ++;
+
+      if (! summary)
+	print_record (rec);
+    }
+
+  munmap (hdr, st.st_size);
+  return 0;
+}
+
+
+/* How to use this program */
+static void usage (char * progname)
+{
+  printf ("Usage: %s [options] file ...\n", progname);
+  printf ("  -h host    only the records of the given host (as numbered when added)\n");
+  printf ("  -r result  only the records with the given result (%d reply, %d timeout)\n", PING_ERR_NONE, PING_ERR_TIMEOUT);
+  printf ("  -f secs    only the records not before the given time (secs since the Epoch)\n");
+  printf ("  -t secs    only the records not after the given time (secs since the Epoch)\n");
+  printf ("  -s         only print a summary of the records matching\n");
+}
+
+
+int main (int argc, char * argv [])
+{
+  /* Notice the program name */
+  char * progname = strrchr (argv [0], '/');
+  int option;
+  int rc = 0;
+  progname = ! progname ? * argv : progname + 1;
+
+  /* Parse command line options */
+  while ((option = getopt (argc, argv, "h:r:f:t:s")) != -1)
+    switch (option)
+      {
+      case 'h': host = atol (optarg);   break;
+      case 'r': result = atoi (optarg); break;
+      case 'f': from = nsecs (optarg);  break;
+      case 't': to = nsecs (optarg);    break;
+      case 's': summary = 1;            break;
+      default:
+	usage (progname);
+	return 1;
+      }
+
+  /* Move pointer to arguments (if any) passed on the command line */
+  argv += optind;
+
+  if (! * argv)
+    {
+      printf ("%s: missing argument(s)\n", progname);
+      return 1;
+    }
+
+  for (; * argv; argv ++)
+    if (scan (* argv) == -1)
+      {
+	fprintf (stderr, "%s: cannot scan %s\n", progname, * argv);
+	rc = 1;
+      }
+
+  printf ("%llu records (%llu replies, %llu timeouts)", records, replies, timeouts);
+  if (replies)
+    printf (", rtt min/avg/max = %.3f/%.3f/%.3f ms", rtt_min / 1e6, rtt_sum / replies / 1e6, rtt_max / 1e6);
+  printf ("\n");
+
+  return rc;
+}
@@ -29,14 +29,63 @@
 #endif
 
 #include <unistd.h>
+#include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <errno.h>
 #include <assert.h>
 #include <values.h>
 #include <netdb.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip_icmp.h>
 #include <arpa/inet.h>
 #include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/sock_diag.h>)
+#include <linux/sock_diag.h>
+#define EVPING_HAVE_SK_MEMINFO
+#endif
+#endif
+
+#ifndef SIOCINQ
+#define SIOCINQ FIONREAD
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/if_packet.h>) && __has_include(<linux/filter.h>)
+#include <sys/mman.h>
+#include <net/if.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#endif
+#endif
+
+/* The optional receive path via a memory-mapped packet ring needs TPACKET_V3 and PACKET_IGNORE_OUTGOING (Linux 4.20+ headers) */
+#if defined(TPACKET3_HDRLEN) && defined(PACKET_IGNORE_OUTGOING)
+#define EVPING_HAVE_PACKET_RING
+#endif
+
+/* The optional io_uring transport needs multishot receives and provided buffer rings (Linux 6.0+ headers) */
+#if defined(IORING_RECV_MULTISHOT) && defined(IORING_RECVSEND_FIXED_BUF) && defined(__NR_io_uring_setup)
+#define EVPING_HAVE_IO_URING
+#endif
 
 #include <event2/event.h>
 #include <event2/event_struct.h>
@@ -66,15 +115,223 @@
 #define MAX_DATA_SIZE      (IP_MAXPACKET - IPHDR - ICMP_MINLEN)
 #define DEFAULT_PKT_SIZE   ICMP_MINLEN + DEFAULT_DATA_SIZE
 
+/*
+ * Compact probes carry no payload: the slot of the host is split between the identifier
+ * (high bits, offset from the one of the process with its top bit flipped) and the high
+ * byte of the sequence, whose low byte is the sequence of the host.  The identifier of the
+ * process, which the other probes carry as is, is taken in network byte order here as
+ * the identifiers of compact probes are, so that it is 0x8000 past their base and out
+ * of the range of their offsets.  The two kinds of probes can then never be mistaken.
+ */
+#define COMPACT_ID_BASE(pid) (ntohs(0xffff & (pid)) ^ 0x8000)
+#define COMPACT_MAX_HOSTS  (1 << 23)           /* # of slots which fit in the identifier and the sequence */
+
+typedef char compact_ids_below_the_process_id[(COMPACT_MAX_HOSTS >> 8) <= 0x8000 ? 1 : -1];
+
 /* Intervals and timeouts (all are in milliseconds unless otherwise specified) */
 #define DEFAULT_NOREPLY_TIMEOUT 500            /* 1/2 sec - 0 is illegal     */
 #define DEFAULT_PING_INTERVAL   1000           /* 1 sec - 0 means flood mode */
 
+/* Socket buffers */
+#define SKB_OVERHEAD       768                 /* Kernel memory charged per packet besides its data */
+#define MAX_SOCKBUF        (64 << 20)          /* Upper limit when sized automatically              */
+
+/* The receive queue depth is sampled once every RXQ_SAMPLING read events */
+#define RXQ_SAMPLING       64
+
+/* Default # of samples per host in the shared memory segment */
+#define DEFAULT_SHM_SAMPLES 32
+
+/* Ranges of addresses */
+#define RANGE_INDEX        0x80000000          /* Set in the index of the probes to addresses in ranges */
+#define RANGE_MIN_PREFIX   8                   /* Largest range is a /8                                 */
+#define RANGE_BATCH        64                  /* # of probes sent at once while sweeping               */
+#define RANGE_RETRY        1                   /* Wait before sending again on full buffers (msecs)    */
+
+
+/* Recording and replay of the packets received */
+#define PCAP_MAGIC         0xa1b2c3d4          /* Timestamps in usecs                      */
+#define PCAP_MAGIC_NSEC    0xa1b23c4d          /* Timestamps in nsecs (replay only)        */
+#define PCAP_LINKTYPE_RAW  101                 /* Packets begin with the IP header         */
+#define PCAP_SNAPLEN       IP_MAXPACKET
+#define WRITER_BUFFER      (1 << 20)           /* Bytes buffered before a write            */
+
+/* The probe log */
+#define DEFAULT_LOG_RECORDS (1 << 20)          /* Records per segment file                  */
+#define LOG_HDR_SIZE       64                  /* Room for struct evping_log_header         */
+#define LOG_SYNC           1                   /* Secs between writes of the current segment */
+
 
 /* Definition for various types of counters */
 typedef uint64_t counter_t;
 
 
+/* Headers of the pcap file format */
+struct pcap_file_header {
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec_header {
+	uint32_t ts_sec;
+	uint32_t ts_usec;              /* or nsecs */
+	uint32_t incl_len;
+	uint32_t orig_len;
+};
+
+
+/*
+ * A file written by a thread of its own from two buffers in turn, so that the loop never waits for the disk.
+ * Data is dropped rather than waiting when the loop fills a buffer while the other one is still being written.
+ */
+struct evping_writer {
+	int fd;
+	u_char *buf[2];
+	size_t fill[2];
+	int active;                    /* The buffer being filled by the loop      */
+	int busy;                      /* Set while the other one is being written */
+	int quit;
+	counter_t drops;               /* # of bytes dropped                       */
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+
+/* A segment file of the probe log, mapped in memory */
+struct evping_logseg {
+	struct evping_log_header *hdr;
+	size_t size;
+	struct evping_logseg *next;    /* In the list of those retired            */
+};
+
+
+/*
+ * The probe log.  The loop appends records to the current segment and takes the next one, which
+ * the thread allocates ahead of time, when it is full.  The thread also writes the segments to disk,
+ * the current one from time to time and the full ones before unmapping them.
+ */
+struct evping_log {
+	char *prefix;
+	uint64_t records;              /* # of records per segment                */
+	unsigned keep;                 /* # of segments kept (0 = all)            */
+	unsigned segment;              /* Number of the next segment to create    */
+	unsigned *created;             /* The last 'keep' + 1 segments created    */
+	unsigned ncreated;
+
+	struct evping_logseg *cur;     /* Being written by the loop               */
+	struct evping_logseg *ready;   /* The next one, allocated by the thread   */
+	struct evping_logseg *retired; /* Full, to be written and unmapped        */
+	int quit;
+
+	counter_t appended;            /* # of records appended                   */
+	counter_t drops;               /* # of records lost with no segment ready */
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+};
+
+
+/*
+ * A timer of the base, dispatched by the event loop or, while simulating, by the virtual clock.
+ * The callback and its argument are kept by the event in both cases.
+ */
+struct evping_timer {
+	struct event event;
+	struct timeval when;           /* Virtual time it expires at              */
+	uint64_t order;                /* Timers expiring at the same time fire in the order they were added */
+	unsigned pos;                  /* Its place in the heap of the virtual clock + 1 (0 = not pending) */
+};
+
+
+/* A capture being replayed through the receive path */
+struct evping_replay {
+	u_char *map;                   /* The file mapped in memory               */
+	size_t size;
+	size_t off;                    /* Next record                             */
+	int nsecs;                     /* Set if the timestamps are in nsecs      */
+	int paced;                     /* Set to replay at the original pace      */
+	struct timeval first;          /* Time the first packet was received      */
+	struct timeval start;          /* Time the replay has begun               */
+	struct evping_timer timer;     /* Timer to feed the next packets          */
+	counter_t packets;             /* # of packets replayed                   */
+};
+
+
+#ifdef EVPING_HAVE_IO_URING
+
+/* Sizes of the io_uring transport */
+#define URING_ENTRIES      256                 /* Submission queue entries (and send slots) */
+#define URING_CQ_ENTRIES   4096                /* Completion queue entries                  */
+#define URING_RECV_BUFS    1024                /* Provided receive buffers (power of 2)     */
+#define URING_BGID         1                   /* Buffer group identifier                   */
+#define URING_RECV_TAG     0                   /* 'user_data' of the multishot receive      */
+
+/* A preallocated buffer used to transmit an ICMP Echo Request */
+struct evping_uring_slot {
+	u_char *buffer;                /* Packet (part of the registered area)    */
+	struct sockaddr_in to;         /* Destination address                     */
+	int host;                      /* Index of the host being pinged          */
+	struct iovec iov;              /* Used by IORING_OP_SENDMSG only          */
+	struct msghdr msg;             /* Used by IORING_OP_SENDMSG only          */
+	int refs;                      /* # of requests not yet completed         */
+	u_char zc;                     /* Last transmitted with IORING_OP_SEND_ZC */
+	int next;                      /* Next free slot (or -1)                  */
+};
+
+/* How to keep track of the io_uring transport */
+struct evping_uring {
+	int ringfd;                    /* The io_uring instance                   */
+	int efd;                       /* eventfd signalled on completions        */
+
+	struct event event;            /* Used to detect read events on 'efd'     */
+	struct event flush;            /* Used to batch submissions per loop run  */
+	u_char flushing;               /* Set when 'flush' has been activated     */
+	u_char nozc;                   /* Zero-copy sends are not supported       */
+
+	/* Submission queue */
+	void *sqring;
+	size_t sqring_sz;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned sq_mask;
+	unsigned sq_entries;
+	unsigned sq_local;             /* Tail not yet published to the kernel    */
+	struct io_uring_sqe *sqes;
+	size_t sqes_sz;
+
+	/* Completion queue */
+	void *cqring;
+	size_t cqring_sz;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned cq_mask;
+	struct io_uring_cqe *cqes;
+
+	/* Provided buffer ring for the multishot receive */
+	struct msghdr rmsg;            /* Layout of each buffer (control only)    */
+	struct io_uring_buf_ring *br;
+	size_t br_sz;
+	u_char *rbufs;
+	size_t rbuf_size;
+	unsigned short br_tail;
+
+	/* Registered send slots */
+	u_char *sbufs;
+	size_t sbuf_size;
+	struct evping_uring_slot slots[URING_ENTRIES];
+	int freeslot;                  /* Head of the list of free slots          */
+};
+
+#endif /* EVPING_HAVE_IO_URING */
+
+
 /* User Data added to the ICMP header
  *
  * The 'ts' is the time the request is sent on the wire
@@ -89,6 +346,125 @@ struct evdata {
 };
 
 
+#ifdef EVPING_HAVE_PACKET_RING
+
+/* Sizes of the packet ring */
+#define RING_BLOCK_SIZE    (1 << 20)           /* Bytes per block                           */
+#define RING_BLOCK_NR      32                  /* # of blocks in the ring                   */
+#define RING_FRAME_SIZE    2048                /* Hint only, frames are variable sized      */
+#define RING_BLOCK_TOV     1                   /* Retire partially filled blocks (msecs)    */
+
+/* How to keep track of the memory-mapped TPACKET_V3 receive ring */
+struct evping_ring {
+	int fd;                        /* AF_PACKET socket bound to the interface */
+	struct event event;            /* Used to detect retired blocks           */
+	u_char *map;                   /* The ring shared with the kernel         */
+	size_t map_sz;
+	unsigned cur;                  /* Next block to be read                   */
+	counter_t drops;               /* # of packets dropped for lack of room   */
+};
+
+#endif /* EVPING_HAVE_PACKET_RING */
+
+
+/* A range of addresses given as a prefix, whose targets are kept in a flat array */
+struct evrange {
+	uint32_t addr;                 /* First address (host byte order)         */
+	uint32_t first;                /* Its slot in the array of targets        */
+	uint32_t count;                /* # of addresses                          */
+};
+
+
+/* What is known about an address of a range until it replies, then its host descriptor takes over */
+struct evtarget {
+	uint32_t sent;                 /* # of ICMP Echo Requests sent            */
+	int32_t host;                  /* Index into the array of hosts, or -1    */
+	u_int8_t lastseq;              /* Sequence of the last reply credited     */
+};
+
+
+/* A raw socket bound to an interface or to a source address, which the hosts assigned to it are probed from */
+struct evping_source {
+	struct evping_base *base;
+	char *name;                    /* Interface or address as given           */
+	evutil_socket_t fd;            /* Raw socket bound to it                  */
+	struct event event;            /* Used to detect read events on 'fd'      */
+	unsigned hosts;                /* # of hosts probed from it               */
+
+	counter_t sentok;              /* # of successful sendto()                */
+	counter_t sendfail;            /* # of failed sendto()                    */
+	counter_t recvok;              /* # of packets read                       */
+	counter_t replies;             /* # of replies to its hosts               */
+	counter_t kdrops;              /* # of packets dropped by the kernel      */
+};
+
+
+/*
+ * A group of hosts (a site, a rack) whose results are rolled up as those of its hosts are updated,
+ * so that its health is known without walking its hosts.  The loss rates are those over the last
+ * 16 and 64 requests of each host, the bits leaving the window of a host being taken off the group.
+ */
+struct evgroup {
+	char *name;
+	unsigned hosts;                /* # of hosts in the group                 */
+	unsigned losing;               /* # of hosts whose last request was lost  */
+
+	counter_t sentpkts;            /* Total # of ICMP Echo Requests sent      */
+	counter_t recvpkts;            /* Total # of ICMP Echo Replies received   */
+	counter_t dropped;             /* # of ICMP packets dropped               */
+
+	unsigned outcomes16;           /* # of outcomes in the windows of 16      */
+	unsigned lost16;               /* # of them lost                          */
+	unsigned outcomes64;           /* # of outcomes in the windows of 64      */
+	unsigned lost64;               /* # of them lost                          */
+
+	/* Counters for statistics */
+	double shortest;               /* Shortest reply time                     */
+	double longest;                /* Longest reply time                      */
+	double sum;                    /* Sum of reply times                      */
+	double square;                 /* Sum of square of reply times            */
+	struct evping_histogram rtt;   /* Reply times (usecs)                     */
+};
+
+
+/* An Echo Reply of the simulated responder, delivered to the receive path when its timer expires */
+struct evping_sim_reply {
+	struct evping_timer timer;
+	struct evping_base *base;
+	struct evping_source *source;  /* The socket it is read from              */
+	u_char *packet;                /* IP header included                      */
+	int len;
+	int size;                      /* # of bytes allocated for 'packet'       */
+	struct evping_sim_reply *next; /* In the list of those free               */
+};
+
+
+/*
+ * The virtual clock.  Time only moves when the next timer is dispatched, so that hours
+ * of probing run in as long as the processing of the probes takes.  Nothing goes on the
+ * wire: the requests are answered by a simulated responder after a round trip time and
+ * a jitter of its own, unless they are lost or their host is dead.
+ */
+struct evping_sim {
+	struct timeval now;            /* The virtual time                        */
+	struct evping_timer **heap;    /* The pending timers, earliest first      */
+	unsigned ntimers;
+	unsigned heap_sz;              /* # of entries allocated in 'heap'        */
+	uint64_t order;                /* Order of the next timer added           */
+
+	/* The simulated responder */
+	unsigned rtt;                  /* Round trip time (usecs)                 */
+	unsigned jitter;               /* Up to as much added to each one (usecs) */
+	unsigned loss;                 /* % of requests lost                      */
+	unsigned dead;                 /* % of hosts which never reply            */
+	uint64_t seed;                 /* State of the random number generator    */
+	struct evping_sim_reply *free; /* Replies ready to be used again          */
+
+	counter_t timers;              /* # of timers dispatched                  */
+	counter_t lost;                /* # of requests not replied               */
+};
+
+
 /* How to keep track of each host to ping */
 struct evhost {
 	struct evping_base *base;
@@ -100,9 +476,17 @@ struct evhost {
 
 	int index;                     /* Index into the array of hosts           */
 	u_int8_t seq;                  /* ICMP sequence (modulo 256) for next run */
-
-	struct event noreply_timer;    /* Timer to handle ICMP timeout            */
-	struct event ping_timer;       /* Timer to ping host at given intervals   */
+	u_char oneshot;                /* Set when probed once by evping_host_probe() */
+	u_char range;                  /* Set for the addresses of ranges, pinged by sweeps only */
+	u_char unresolved;             /* Set until its reverse name has been looked up          */
+	struct timeval sendtime;       /* Time the last compact probe was sent                   */
+	struct evgroup *group;         /* The group it was tagged with (if any)                  */
+	struct evping_source *source;  /* Where it is probed from (NULL = the default socket)    */
+	int remaining;                 /* # of probes left in a sweep (0 = forever)              */
+	struct timeval due;            /* Time the next ping is scheduled at      */
+
+	struct evping_timer noreply_timer;  /* Timer to handle ICMP timeout       */
+	struct evping_timer ping_timer;     /* Timer to ping host at given intervals */
 
 	/* Packets Counters */
 	counter_t sentpkts;            /* Total # of ICMP Echo Requests sent      */
@@ -125,6 +509,14 @@ struct evhost {
 	double sum;                    /* Sum of reply times                      */
 	double square;                 /* Sum of square of reply times            */
 
+	/* Jitter and loss patterns */
+	double jitter;                 /* RFC 3550 interarrival jitter (usecs)    */
+	time_t lastrtt;                /* Round trip time of the last reply       */
+	unsigned lossrun;              /* # of requests lost in a row up to now   */
+	unsigned longestrun;           /* Longest run of requests lost in a row   */
+	struct evping_histogram lossruns;  /* Lengths of the runs once ended      */
+	uint64_t window;               /* Last 64 outcomes, a bit set when lost   */
+
 	evping_callback_type user_callback;
 	void *user_pointer;            /* the pointer given to us for this host   */
 
@@ -144,10 +536,56 @@ struct evping_base {
 
 	struct timeval tv_noreply;     /* ICMP Echo Reply timeout                    */
 	struct timeval tv_interval;    /* Ping interval between two subsequent pings */
+	struct timeval tv_backoff;     /* Cap of the backoff of hosts not replying (0 = none) */
 
 	/* A circular list of hosts to ping */
 	struct evhost *host_head;
 	unsigned argc;                 /* # of hosts to be pinged                    */
+	struct evhost **hosts;         /* The same hosts indexed by their index      */
+	unsigned hosts_sz;             /* # of entries allocated in 'hosts'          */
+	unsigned prepared;             /* # of hosts the transport was prepared for  */
+
+	/* Ranges of addresses, swept with no host descriptor until they reply */
+	struct evrange *ranges;
+	unsigned nranges;
+	struct evtarget *targets;      /* The addresses of all the ranges            */
+	uint32_t ntargets;
+	struct evping_timer sweep;     /* Timer to send the next batch of a sweep    */
+	uint32_t cursor;               /* Next target to be sent in this sweep       */
+	u_int8_t sweepseq;             /* ICMP sequence of this sweep                */
+	uint32_t sweepreplies;         /* # of replies to this sweep                 */
+	struct timeval sweepstart;     /* Time this sweep has begun                  */
+	struct timeval sweeptime;      /* Time the last sweep took to complete       */
+	counter_t sweeps;              /* # of sweeps completed                      */
+	uint32_t responders;           /* # of targets which have replied            */
+	size_t rangemem;               /* Memory held for the ranges (bytes)         */
+	evping_callback_type user_callback;  /* For the replies to sweeps        */
+	void *user_pointer;
+	int remaining;                 /* # of sweeps of the ranges left (0 = forever) */
+
+	struct evping_writer *pcap;    /* Where the packets received are recorded    */
+	struct evping_log *log;        /* Where the outcome of each probe is logged  */
+	uint64_t logrecords;           /* # of records per segment of the log        */
+	unsigned logsegments;          /* # of segments of the log kept (0 = all)    */
+	struct evping_replay *replay;  /* The capture being replayed (if any)        */
+	struct evping_sim *sim;        /* The virtual clock (if simulating)          */
+
+	/* Groups of hosts, numbered in the order they have been added */
+	struct evgroup **groups;
+	unsigned ngroups;
+	unsigned groups_sz;            /* # of entries allocated in 'groups'         */
+
+	/* Sources other than the default socket, numbered in the order they have been added */
+	struct evping_source **sources;
+	unsigned nsources;
+	unsigned sources_sz;           /* # of entries allocated in 'sources'        */
+	u_char muted;                  /* Set while the default socket is not read   */
+
+	/* Count-limited sweeps */
+	unsigned pending;              /* # of hosts (the ranges count as one) not done yet */
+	struct evping_timer done;      /* Timer to notify the user they are all done       */
+	evping_done_callback_type done_callback;
+	void *done_pointer;
 
 	struct event event;            /* Used to detect read events on raw socket   */
 
@@ -158,8 +596,36 @@ struct evping_base {
 	counter_t tooshort;            /* # of ICMP packets too short (illegal ICMP) */
 	counter_t foreign;             /* # of ICMP packets we are not looking for   */
 	counter_t illegal;             /* # of ICMP packets with an illegal payload  */
+	counter_t kdrops;              /* # of packets dropped by the kernel         */
+	counter_t revents;             /* # of read events (to sample the queue)     */
+
+	/* Histograms */
+	struct evping_histogram lateness; /* Delay of pings over their schedule      */
+	struct evping_histogram delay;    /* Delay from reply arrival to processing  */
+	struct evping_histogram rxqueue;  /* Receive queue depth                     */
+
+	/* Shared memory segment to publish the samples to */
+	char *shmname;                 /* Name of the POSIX shared memory object     */
+	unsigned shmsamples;           /* # of samples per host                      */
+	struct evping_shm_header *shm; /* The segment (if any is active)             */
+	size_t shm_sz;
+
+	int rcvbuf;                    /* Socket receive buffer size (0 = automatic) */
+	int sndbuf;                    /* Socket send buffer size (0 = automatic)    */
 
 	u_char quiet;
+	u_char use_uring;              /* Set to transmit/receive via io_uring       */
+	u_char compact;                /* Set to send compact probes with no payload */
+	u_char sized;                  /* Set once the size has been given           */
+
+#ifdef EVPING_HAVE_IO_URING
+	struct evping_uring *uring;    /* The io_uring transport (if any is active)  */
+#endif
+
+	char *ringif;                  /* Interface to read replies from via a ring  */
+#ifdef EVPING_HAVE_PACKET_RING
+	struct evping_ring *ring;      /* The packet ring (if any is active)         */
+#endif
 
 #ifndef _EVENT_DISABLE_THREAD_SUPPORT
 	void *lock;
@@ -202,22 +668,189 @@ msecstotv(time_t msecs, struct timeval *tv)
 }
 
 
+/* Add a value to a histogram */
+static void
+histogram_add(struct evping_histogram *h, int64_t value)
+{
+	int i = value > 0 ? 64 - __builtin_clzll(value) : 0;
+
+	if (value < 0)
+	  value = 0;
+
+	h->buckets[MIN(i, EVPING_HIST_BUCKETS - 1)]++;
+	h->count++;
+	h->sum += value;
+	h->max = MAX(h->max, (uint64_t) value);
+}
+
+
+/* Convert a string to a non-negative integer, or return -1 on error */
+static int
+strtoint(const char *const str)
+{
+	char *endptr;
+	const long r = strtol(str, &endptr, 10);
+	if (!*str || *endptr || r < 0 || r > INT_MAX) return -1;
+	return (int)r;
+}
+
+
+/* Return true iff 'option' is the name of the option 'option_name' (with or without the trailing colon) */
+static int
+str_matches_option(const char *option, const char *option_name)
+{
+	const size_t len = strlen(option);
+	return !strncmp(option, option_name, len) &&
+	    (option_name[len] == ':' || option_name[len] == '\0');
+}
+
+
 /* Lookup for a host by its index */
 static struct evhost *
 evping_lookup_host(struct evping_base *base, int index)
 {
-	struct evhost *host;
+	return index >= 0 && (unsigned) index < base->argc ? base->hosts[index] : NULL;
+}
 
-	host = base->host_head;
-	if (!host)
-		goto done;
-	do {
-		if (host->index == index)
-		  return host;
-		host = host->next;
-	} while (host != base->host_head);
-done:
-	return NULL;
+
+/* The current time, the virtual one while simulating */
+static void
+evping_now(struct evping_base *base, struct timeval *tv)
+{
+	if (base->sim)
+	  *tv = base->sim->now;
+	else
+	  gettimeofday(tv, NULL);
+}
+
+
+/* The time cached by the event loop, the virtual one while simulating */
+static void
+evping_now_cached(struct evping_base *base, struct timeval *tv)
+{
+	if (base->sim)
+	  *tv = base->sim->now;
+	else
+	  event_base_gettimeofday_cached(base->event_base, tv);
+}
+
+
+/* Return true iff timer 'a' fires before timer 'b' */
+static int
+sim_before(const struct evping_timer *a, const struct evping_timer *b)
+{
+	if (evutil_timercmp(&a->when, &b->when, !=))
+	  return evutil_timercmp(&a->when, &b->when, <);
+	return a->order < b->order;
+}
+
+
+/* Move the timer at 'i' of the heap of the virtual clock up or down to its place */
+static void
+sim_sift(struct evping_sim *sim, unsigned i)
+{
+	struct evping_timer *t = sim->heap[i];
+	unsigned child;
+
+	while (i && sim_before(t, sim->heap[(i - 1) / 2]))
+	  {
+	    sim->heap[i] = sim->heap[(i - 1) / 2];
+	    sim->heap[i]->pos = i + 1;
+	    i = (i - 1) / 2;
+	  }
+
+	while ((child = 2 * i + 1) < sim->ntimers)
+	  {
+	    if (child + 1 < sim->ntimers && sim_before(sim->heap[child + 1], sim->heap[child]))
+	      child++;
+	    if (!sim_before(sim->heap[child], t))
+	      break;
+	    sim->heap[i] = sim->heap[child];
+	    sim->heap[i]->pos = i + 1;
+	    i = child;
+	  }
+
+	sim->heap[i] = t;
+	t->pos = i + 1;
+}
+
+
+/* Take a timer off the heap of the virtual clock */
+static void
+sim_remove(struct evping_sim *sim, struct evping_timer *t)
+{
+	unsigned i = t->pos - 1;
+
+	t->pos = 0;
+	if (i < --sim->ntimers)
+	  {
+	    sim->heap[i] = sim->heap[sim->ntimers];
+	    sim_sift(sim, i);
+	  }
+}
+
+
+/* Add a timer to the heap of the virtual clock to fire after 'tv', or return -1 in the event of error */
+static int
+sim_add(struct evping_sim *sim, struct evping_timer *t, const struct timeval *tv)
+{
+	/* Make room in the heap */
+	if (!t->pos && sim->ntimers == sim->heap_sz)
+	  {
+	    unsigned n = sim->heap_sz ? 2 * sim->heap_sz : 16;
+	    struct evping_timer **heap = mm_realloc(sim->heap, n * sizeof(struct evping_timer *));
+	    if (!heap)
+	      return -1;
+	    sim->heap = heap;
+	    sim->heap_sz = n;
+	  }
+
+	evutil_timeradd(&sim->now, tv, &t->when);
+	t->order = sim->order++;
+
+	/* As evtimer_add(), a pending timer is rescheduled */
+	if (!t->pos)
+	  {
+	    sim->heap[sim->ntimers] = t;
+	    t->pos = ++sim->ntimers;
+	  }
+	sim_sift(sim, t->pos - 1);
+
+	return 0;
+}
+
+
+/* Define the callback of a timer */
+static void
+evping_timer_assign(struct evping_base *base, struct evping_timer *t, event_callback_fn callback, void *arg)
+{
+	evtimer_assign(&t->event, base->event_base, callback, arg);
+	t->pos = 0;
+}
+
+
+/* Add a timer to fire after 'tv', to the virtual clock while simulating */
+static int
+evping_timer_add(struct evping_base *base, struct evping_timer *t, const struct timeval *tv)
+{
+	return base->sim ? sim_add(base->sim, t, tv) : evtimer_add(&t->event, tv);
+}
+
+
+static void
+evping_timer_del(struct evping_base *base, struct evping_timer *t)
+{
+	if (t->pos)
+	  sim_remove(base->sim, t);
+	else
+	  evtimer_del(&t->event);
+}
+
+
+static int
+evping_timer_pending(struct evping_timer *t)
+{
+	return t->pos || evtimer_pending(&t->event, NULL);
 }
 
 
@@ -267,22 +900,20 @@ static int mkcksum(u_short *p, int n)
  * to keep an unique integer used as index in the array
  * ho hosts being monitored
  */
-static void fmticmp(u_char *buffer, unsigned size, u_int8_t seq, uint32_t index, pid_t pid)
+static void fmticmp(u_char *buffer, unsigned size, u_int8_t seq, uint32_t index, pid_t pid, const struct timeval *now)
 {
 	struct icmp *icmp = (struct icmp *) buffer;
 	struct evdata *data = (struct evdata *) (buffer + ICMP_MINLEN);
 
-	struct timeval now;
-
 	/* The ICMP header (no checksum here until user data has been filled in) */
 	icmp->icmp_type = ICMP_ECHO;             /* type of message */
 	icmp->icmp_code = 0;                     /* type sub code */
 	icmp->icmp_id   = 0xffff & pid;          /* unique process identifier */
 	icmp->icmp_seq  = htons(seq);            /* message identifier */
+	icmp->icmp_cksum = 0;                    /* the buffer may be reused */
 
 	/* User data */
-	gettimeofday(&now, NULL);
-	data->ts    = now;                       /* current time */
+	data->ts    = *now;                      /* current time */
 	data->index = index;                     /* index into an array */
 
 	/* Last, compute ICMP checksum */
@@ -290,112 +921,714 @@ static void fmticmp(u_char *buffer, unsigned size, u_int8_t seq, uint32_t index,
 }
 
 
-/* Attempt to transmit an ICMP Echo Request to a given host */
-static void ping_callback(int unused, const short event, void *h)
+/* Fill in a compact ICMP Echo Request for a given host, whose send time is kept locally */
+static void fmticmp_compact(u_char *buffer, unsigned size, struct evhost *host, pid_t pid)
 {
-	struct evhost *host = h;
-	struct evping_base *base = host->base;
-
-	u_char packet [MAX_DATA_SIZE] = "";
-	int nsent;
+	struct icmp *icmp = (struct icmp *) buffer;
+	uint32_t index = host->index;
 
-	/* Clean the no reply timer (if any was previously set) */
-	evtimer_del(&host->noreply_timer);
+	/* The ICMP header (no checksum here until the padding has been cleared) */
+	icmp->icmp_type = ICMP_ECHO;
+	icmp->icmp_code = 0;
+	icmp->icmp_id   = htons((COMPACT_ID_BASE(pid) + (index >> 8)) & 0xffff);
+	icmp->icmp_seq  = htons(((index & 0xff) << 8) | host->seq);
+	icmp->icmp_cksum = 0;
 
-	/* Format the ICMP Echo Reply packet to send */
-	fmticmp(packet, base->pktsize, host->seq, host->index, base->pid);
+	/* The buffer may be reused, and holds no user data */
+	memset(buffer + ICMP_MINLEN, 0, size - ICMP_MINLEN);
 
-	/* Transmit the request over the network */
-	nsent = sendto(base->rawfd, packet, base->pktsize, MSG_DONTWAIT,
-		       (struct sockaddr *) &host->saddr, sizeof(struct sockaddr_in));
+	evping_now(host->base, &host->sendtime);
 
-	if (nsent == base->pktsize)
-	  {
-	    /* One more ICMP Echo Request sent */
-	    base->sentok++;
+	icmp->icmp_cksum = mkcksum((u_short *) icmp, size);
+}
 
-	    if (!host->sentpkts && !base->quiet)
-	      printf("PING %s (%s) %d(%d) bytes of data.\n", host->fqname, host->ipname,
-		     base->pktsize - ICMP_MINLEN, nsent + IPHDR);
 
-	    /* Update timestamps and counters */
-	    if (!host->sentpkts)
-	      gettimeofday(&host->firstsent, NULL);
-	    gettimeofday (&host->lastsent, NULL);
-	    host->sentpkts++;
-	    host->sentbytes += nsent;
+/* Fill in the next ICMP Echo Request for a given host in the format in use */
+static void
+evhost_fmticmp(struct evping_base *base, struct evhost *host, u_char *buffer)
+{
+	struct timeval now;
 
-	    /* Add the timer to handle no reply condition in the given timeout */
-	    evtimer_add(&host->noreply_timer, &base->tv_noreply);
-	  }
+	if (base->compact)
+	  fmticmp_compact(buffer, base->pktsize, host, base->pid);
 	else
-	  base->sendfail++;
+	  {
+	    evping_now(base, &now);
+	    fmticmp(buffer, base->pktsize, host->seq, host->index, base->pid, &now);
+	  }
 }
 
 
-/* The callback to handle timeouts due to destination host unreachable condition */
-static void noreply_callback(int unused, const short event, void *h)
+/* The name of a segment file of the probe log */
+static void
+logseg_name(struct evping_log *log, unsigned segment, char *name, size_t size)
 {
-	struct evhost *host = h;
+	snprintf(name, size, "%s.%06u", log->prefix, segment);
+}
 
-	host->dropped++;
 
-	/* Add the timer to ping again the host at the given time interval */
-	evtimer_add(&host->ping_timer, &host->base->tv_interval);
+/* Create and map in memory the next segment file, or return NULL in the event of error */
+static struct evping_logseg *
+logseg_new(struct evping_log *log)
+{
+	struct evping_logseg *seg;
+	char name[PATH_MAX];
+	size_t size = LOG_HDR_SIZE + log->records * sizeof(struct evping_log_record);
+	int fd;
 
-	if (host->user_callback)
-	  host->user_callback(PING_ERR_TIMEOUT, -1, host->fqname, host->ipname,
-			      host->seq, -1, &host->base->tv_noreply, host->user_pointer);
+	/* Existing files are never overwritten */
+	for (;;)
+	  {
+	    logseg_name(log, log->segment, name, sizeof(name));
+	    if ((fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0644)) != -1)
+	      break;
+	    if (errno != EEXIST)
+	      return NULL;
+	    log->segment++;
+	  }
 
-	/* Update the sequence number for the next run */
-	host->seq = (host->seq + 1) % 256;
+	/* Allocated in full and faulted in now, so that the loop neither waits for the disk nor takes page faults */
+	if (posix_fallocate(fd, 0, size) || !(seg = mm_calloc(1, sizeof(struct evping_logseg))))
+	  {
+	    close(fd);
+	    unlink(name);
+	    return NULL;
+	  }
+	seg->size = size;
+	seg->hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+	close(fd);
+	if (seg->hdr == MAP_FAILED)
+	  {
+	    mm_free(seg);
+	    unlink(name);
+	    return NULL;
+	  }
+
+	seg->hdr->magic = EVPING_LOG_MAGIC;
+	seg->hdr->version = EVPING_LOG_VERSION;
+	seg->hdr->hdr_size = LOG_HDR_SIZE;
+	seg->hdr->record_size = sizeof(struct evping_log_record);
+	seg->hdr->records = log->records;
+	seg->hdr->segment = log->segment;
+	seg->hdr->pid = getpid();
+	seg->hdr->created = time(NULL);
+
+	/* Remove the oldest segment once 'keep' more have been created, not counting the one allocated ahead */
+	if (log->keep)
+	  {
+	    unsigned *slot = &log->created[log->ncreated++ % (log->keep + 1)];
+	    if (log->ncreated > log->keep + 1)
+	      {
+		logseg_name(log, *slot, name, sizeof(name));
+		unlink(name);
+	      }
+	    *slot = log->segment;
+	  }
+	log->segment++;
+
+	return seg;
 }
 
 
 /*
- * Called by libevent when the kernel says that the raw socket is ready for reading.
- *
- * It reads a packet from the wire and attempt to decode and relate ICMP Echo Request/Reply.
- *
- * To be legal the packet received must be:
- *  o of enough size (> IPHDR + ICMP_MINLEN)
- *  o of ICMP Protocol
- *  o of type ICMP_ECHOREPLY
- *  o the one we are looking for (matching the same identifier of all the packets the program is able to send)
+ * Write a segment to disk and unmap it, a segment not full is truncated to its records and
+ * its header updated to match, or left at its full size and as it is if it cannot be
  */
-static void ready_callback (int unused, const short event, void * arg)
+static void
+logseg_free(struct evping_log *log, struct evping_logseg *seg)
 {
-	struct evping_base *base = arg;
+	char name[PATH_MAX];
+	uint64_t count = seg->hdr->count;
 
-	int nrecv;
-	u_char packet[MAX_DATA_SIZE];
-	struct sockaddr_in remote;                  /* responding internet address */
-	socklen_t slen = sizeof(struct sockaddr);
+	msync(seg->hdr, seg->size, MS_SYNC);
+	if (count < log->records)
+	  {
+	    logseg_name(log, seg->hdr->segment, name, sizeof(name));
+	    if (!count)
+	      unlink(name);
+	    else if (truncate(name, LOG_HDR_SIZE + count * sizeof(struct evping_log_record)) == 0)
+	      {
+		/* The header is in the part kept */
+		seg->hdr->records = count;
+		msync(seg->hdr, LOG_HDR_SIZE, MS_SYNC);
+	      }
+	  }
+	munmap(seg->hdr, seg->size);
+	mm_free(seg);
+}
+
+
+/* The thread allocating the segments of the probe log and writing them to disk */
+static void *
+log_thread(void *arg)
+{
+	struct evping_log *log = arg;
+	struct evping_logseg *seg;
+	struct timespec deadline;
+	int failed = 0;
+
+	pthread_mutex_lock(&log->mutex);
+	for (;;)
+	  {
+	    if ((seg = log->retired))
+	      {
+		log->retired = NULL;
+		pthread_mutex_unlock(&log->mutex);
+		while (seg)
+		  {
+		    struct evping_logseg *next = seg->next;
+		    logseg_free(log, seg);
+		    seg = next;
+		  }
+		pthread_mutex_lock(&log->mutex);
+		continue;
+	      }
+
+	    if (log->quit)
+	      break;
+
+	    if (!log->ready && !failed)
+	      {
+		pthread_mutex_unlock(&log->mutex);
+		seg = logseg_new(log);
+		pthread_mutex_lock(&log->mutex);
+		log->ready = seg;
+		failed = !seg;
+		continue;
+	      }
+
+	    /* Write the current segment to disk from time to time, and try again to allocate on errors */
+	    clock_gettime(CLOCK_REALTIME, &deadline);
+	    deadline.tv_sec += LOG_SYNC;
+	    if (pthread_cond_timedwait(&log->cond, &log->mutex, &deadline) == ETIMEDOUT)
+	      {
+		if (log->cur)
+		  msync(log->cur->hdr, log->cur->size, MS_ASYNC);
+		failed = 0;
+	      }
+	  }
+	pthread_mutex_unlock(&log->mutex);
+
+	/* The segment allocated ahead is not needed */
+	if (log->ready)
+	  logseg_free(log, log->ready);
+	log->ready = NULL;
+
+	return NULL;
+}
+
+
+/* Append the outcome of a probe to the log, 'rtt' is NULL on timeout */
+static void
+log_append(struct evping_log *log, struct evhost *host, int seq, int result, int ttl,
+	   const struct timeval *ts, const struct timeval *rtt)
+{
+	struct evping_logseg *seg = log->cur;
+	struct evping_log_record *rec;
+	uint64_t count;
+
+	/* Take the next segment when the current one is full */
+	if (!seg || seg->hdr->count == seg->hdr->records)
+	  {
+	    pthread_mutex_lock(&log->mutex);
+	    if (seg)
+	      {
+		seg->next = log->retired;
+		log->retired = seg;
+	      }
+	    seg = log->cur = log->ready;
+	    log->ready = NULL;
+	    pthread_cond_signal(&log->cond);
+	    pthread_mutex_unlock(&log->mutex);
+
+	    if (!seg)
+	      {
+		log->drops++;
+		return;
+	      }
+	  }
+
+	count = seg->hdr->count;
+	rec = EVPING_LOG_RECORD(seg->hdr, count);
+	rec->ts = ts->tv_sec * 1000000000ULL + ts->tv_usec * 1000ULL;
+	rec->host = host->index;
+	rec->seq = seq;
+	rec->result = result;
+	rec->ttl = ttl;
+	rec->rtt = rtt ? rtt->tv_sec * 1000000000ULL + rtt->tv_usec * 1000ULL : 0;
+	__atomic_store_n(&seg->hdr->count, count + 1, __ATOMIC_RELEASE);
+
+	log->appended++;
+}
+
+
+/* Write what is left to disk and stop the thread */
+static void
+log_free(struct evping_log *log)
+{
+	pthread_mutex_lock(&log->mutex);
+	if (log->cur)
+	  {
+	    log->cur->next = log->retired;
+	    log->retired = log->cur;
+	    log->cur = NULL;
+	  }
+	log->quit = 1;
+	pthread_cond_signal(&log->cond);
+	pthread_mutex_unlock(&log->mutex);
+
+	pthread_join(log->thread, NULL);
+
+	pthread_cond_destroy(&log->cond);
+	pthread_mutex_destroy(&log->mutex);
+	mm_free(log->created);
+	mm_free(log->prefix);
+	mm_free(log);
+}
+
+
+/* Start the probe log with its first segment, or return NULL in the event of error */
+static struct evping_log *
+log_new(const char *prefix, uint64_t records, unsigned keep)
+{
+	struct evping_log *log = mm_calloc(1, sizeof(struct evping_log));
+
+	if (!log)
+	  return NULL;
+	log->prefix = mm_strdup(prefix);
+	log->records = records;
+	log->keep = keep;
+	if (keep)
+	  log->created = mm_calloc(keep + 1, sizeof(unsigned));
+	if (!log->prefix || (keep && !log->created) || !(log->cur = logseg_new(log)))
+	  goto fail;
+
+	pthread_mutex_init(&log->mutex, NULL);
+	pthread_cond_init(&log->cond, NULL);
+	if (pthread_create(&log->thread, NULL, log_thread, log))
+	  {
+	    pthread_cond_destroy(&log->cond);
+	    pthread_mutex_destroy(&log->mutex);
+	    logseg_free(log, log->cur);
+	    goto fail;
+	  }
+	return log;
+
+fail:
+	mm_free(log->created);
+	mm_free(log->prefix);
+	mm_free(log);
+	return NULL;
+}
 
-	/* Pointer to relevant portions of the packet (IP, ICMP and user data) */
-	struct ip * ip = (struct ip *) packet;
-	struct icmphdr * icmp;
-	struct evdata * data = (struct evdata *) (packet + IPHDR + ICMP_MINLEN);
-	int hlen = 0;
 
+/* Add the timer to ping again the host after 'tv' and keep track of when it is due */
+static void
+evhost_schedule(struct evhost *host, const struct timeval *tv)
+{
 	struct timeval now;
-	struct evhost * host;
 
-	/* Time the packet has been received */
-	gettimeofday(&now, NULL);
+	/* Nothing is sent while replaying a capture */
+	if (host->base->replay)
+	  return;
 
-	EVPING_LOCK(base);
+	/* Timers are relative to the time cached by the event loop */
+	evping_now_cached(host->base, &now);
+	evutil_timeradd(&now, tv, &host->due);
+
+	evping_timer_add(host->base, &host->ping_timer, tv);
+}
+
+
+/*
+ * Publish the outcome of a probe ('rtt' in usecs, or -1 on timeout) to the slot of the host in the shared segment.
+ *
+ * The slot is guarded by a sequence number which is odd during the update, so that
+ * readers in other processes can detect and retry torn reads while the writer never waits.
+ */
+static void
+shm_publish(struct evping_base *base, struct evhost *host, time_t when, int64_t rtt)
+{
+	struct evping_shm_header *hdr = base->shm;
+	struct evping_shm_slot *slot;
+	struct evping_shm_sample *sample;
+	uint32_t seq;
+
+	if ((unsigned) host->index >= hdr->slots)
+	  return;
+
+	slot = EVPING_SHM_SLOT(hdr, host->index);
+	seq = slot->seq;
+	__atomic_store_n(&slot->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	sample = &EVPING_SHM_SAMPLES(slot)[slot->count % hdr->samples];
+	sample->sec = when;
+	if (rtt < 0)
+	  {
+	    sample->rtt = EVPING_SHM_TIMEOUT;
+	    slot->timeouts++;
+	  }
+	else
+	  {
+	    sample->rtt = MIN(rtt, EVPING_SHM_TIMEOUT - 1);
+	    slot->last = sample->rtt;
+	    slot->shortest = slot->replies ? MIN(slot->shortest, sample->rtt) : sample->rtt;
+	    slot->longest = MAX(slot->longest, sample->rtt);
+	    slot->sum += sample->rtt;
+	    slot->replies++;
+	  }
+	slot->count++;
+
+	__atomic_store_n(&slot->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Keep track of the outcome of a request ('rtt' in usecs when not lost) in constant time:
+ *  o the jitter is evaluated as in RFC 3550 (6.4.1) from the differences between subsequent round trip times
+ *  o the runs of requests lost in a row are added to a histogram once ended
+ *  o the outcomes of the last 64 requests are kept in a bitmap for the loss rates over sliding windows
+ */
+static void
+evhost_outcome(struct evhost *host, int lost, time_t rtt)
+{
+	struct evgroup *group = host->group;
 
-	/* Receive data from the network */
-	nrecv = recvfrom(base->rawfd, packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr *) &remote, &slen);
-	if (nrecv < 0)
+	/* The group follows the window and the run of losses of the host */
+	if (group)
 	  {
-	    /* One more failure */
-	    base->recvfail++;
+	    counter_t outcomes = host->recvpkts + host->dropped;
+
+	    if (outcomes <= 16)
+	      group->outcomes16++;
+	    else
+	      group->lost16 -= (host->window >> 15) & 1;
+	    if (outcomes <= 64)
+	      group->outcomes64++;
+	    else
+	      group->lost64 -= host->window >> 63;
+	    group->lost16 += lost != 0;
+	    group->lost64 += lost != 0;
+
+	    if (lost && !host->lossrun)
+	      group->losing++;
+	    else if (!lost && host->lossrun)
+	      group->losing--;
+	  }
 
-	    goto done;
+	host->window = (host->window << 1) | (lost != 0);
+
+	if (lost)
+	  {
+	    host->lossrun++;
+	    host->longestrun = MAX(host->longestrun, host->lossrun);
+	    return;
+	  }
+
+	if (host->lossrun)
+	  {
+	    histogram_add(&host->lossruns, host->lossrun);
+	    host->lossrun = 0;
+	  }
+
+	if (host->recvpkts > 1)
+	  host->jitter += (fabs((double) (rtt - host->lastrtt)) - host->jitter) / 16.0;
+	host->lastrtt = rtt;
+}
+
+
+/* One more host done with its probes, the user is notified once they are all done */
+static void
+evping_finished(struct evping_base *base)
+{
+	struct timeval asap = { 0, 0 };
+
+	/* Not from here, so that the callback of the last probe is invoked first */
+	if (base->pending && !--base->pending)
+	  evping_timer_add(base, &base->done, &asap);
+}
+
+
+/*
+ * The interval of a host which has not replied to its last requests: it is doubled at each
+ * request lost in a row, starting from the ping interval (the timeout in flood mode), up to the cap
+ * (unless the cap is below where it starts from)
+ */
+static void
+evhost_backoff(struct evhost *host, struct timeval *tv)
+{
+	struct evping_base *base = host->base;
+	int64_t usecs = evutil_timerisset(&base->tv_interval) ? tvtousecs(&base->tv_interval) : tvtousecs(&base->tv_noreply);
+	int64_t cap = tvtousecs(&base->tv_backoff);
+	int64_t backoff = host->lossrun < 31 ? MIN(usecs << host->lossrun, cap) : cap;
+
+	/* A cap below the starting interval does not make the host probed more often than one replying */
+	usecs = MAX(usecs, backoff);
+	tv->tv_sec = usecs / 1000000;
+	tv->tv_usec = usecs % 1000000;
+}
+
+
+/*
+ * Add the timer to ping again the host at the given time interval, unless it was probed only once
+ * (then the callback of the probe is forgotten, so the caller must have taken it already) or it is done
+ */
+static void
+evhost_next(struct evhost *host)
+{
+	struct timeval tv = host->base->tv_interval;
+
+	if (host->oneshot)
+	  {
+	    host->oneshot = 0;
+	    host->user_callback = NULL;
+	    host->user_pointer = NULL;
+	  }
+	else if (host->remaining && !--host->remaining)
+	  evping_finished(host->base);
+	else
+	  {
+	    /* Back off while the host does not reply, the first reply restores the interval */
+	    if (host->lossrun && evutil_timerisset(&host->base->tv_backoff))
+	      evhost_backoff(host, &tv);
+	    evhost_schedule(host, &tv);
+	  }
+}
+
+
+/*
+ * The callback to handle timeouts due to destination host unreachable condition.
+ *
+ * The user callback is the last thing done, so that it can probe the host again.
+ */
+static void noreply_callback(int unused, const short event, void *h)
+{
+	struct evhost *host = h;
+	evping_callback_type callback = host->user_callback;
+	void *ptr = host->user_pointer;
+	int seq = host->seq;
+
+	host->dropped++;
+	if (host->group)
+	  host->group->dropped++;
+	evhost_outcome(host, 1, 0);
+
+	if (host->base->log)
+	  {
+	    struct timeval now;
+	    evping_now_cached(host->base, &now);
+	    log_append(host->base->log, host, seq, PING_ERR_TIMEOUT, 0, &now, NULL);
+	  }
+
+	if (host->base->shm)
+	  shm_publish(host->base, host, host->lastsent.tv_sec, -1);
+
+	/* Update the sequence number for the next run */
+	host->seq = (host->seq + 1) % 256;
+
+	/* Add the timer to ping again the host at the given time interval */
+	evhost_next(host);
+
+	if (callback)
+	  callback(PING_ERR_TIMEOUT, -1, host->fqname, host->ipname, seq, -1, &host->base->tv_noreply, ptr);
+}
+
+
+/* Update the timestamps and counters of a host for a reply received at 'now' after 'elapsed' */
+static void
+evhost_replied(struct evhost *host, int nrecv, struct timeval *now, struct timeval *elapsed)
+{
+	time_t usecs;
+
+	/* Update timestamps */
+	if (!host->recvpkts)
+	  evping_now(host->base, &host->firstrecv);
+	evping_now(host->base, &host->lastrecv);
+	host->recvpkts++;
+	host->recvbytes += nrecv;
+
+	/* Update counters */
+	usecs = tvtousecs(elapsed);
+	host->shortest = MIN(host->shortest, usecs);
+	host->longest = MAX(host->longest, usecs);
+	host->sum += usecs;
+	host->square += (usecs * usecs);
+
+	if (host->group)
+	  {
+	    struct evgroup *group = host->group;
+	    group->recvpkts++;
+	    group->shortest = MIN(group->shortest, usecs);
+	    group->longest = MAX(group->longest, usecs);
+	    group->sum += usecs;
+	    group->square += (usecs * usecs);
+	    histogram_add(&group->rtt, usecs);
+	  }
+
+	evhost_outcome(host, 0, usecs);
+
+	if (host->base->shm)
+	  shm_publish(host->base, host, now->tv_sec, usecs);
+}
+
+
+static struct evhost *evhost_new(struct evping_base *base, const char *name, struct in_addr addr, const char *fqname);
+static void sweep_done(struct evping_base *base);
+
+
+/* The address of a target in the ranges (network byte order), or INADDR_NONE if there is no such a target */
+static in_addr_t
+range_addr(struct evping_base *base, uint32_t slot)
+{
+	unsigned lo = 0;
+	unsigned hi = base->nranges;
+
+	if (slot >= base->ntargets)
+	  return INADDR_NONE;
+
+	/* Ranges are kept in the order of their slots */
+	while (hi - lo > 1)
+	  {
+	    unsigned mid = (lo + hi) / 2;
+	    if (base->ranges[mid].first <= slot)
+	      lo = mid;
+	    else
+	      hi = mid;
+	  }
+	return htonl(base->ranges[lo].addr + slot - base->ranges[lo].first);
+}
+
+
+/*
+ * Relate a reply to a sweep with its target, which gets a host descriptor the first time it replies.
+ * Replies coming from addresses other than the one the request was sent to are illegal.
+ */
+static void
+range_reply(struct evping_base *base, struct ip *ip, struct icmphdr *icmp, struct evdata *data,
+	    int nrecv, struct timeval *now)
+{
+	uint32_t slot = data->index & ~RANGE_INDEX;
+	in_addr_t addr = range_addr(base, slot);
+	struct evtarget *target;
+	struct evhost *host;
+	struct timeval elapsed;
+	int seq = ntohs(icmp->un.echo.sequence);
+
+	if (addr == INADDR_NONE || addr != ip->ip_src.s_addr)
+	  {
+	    /* One more illegal packet */
+	    base->illegal++;
+
+	    return;
+	  }
+
+	if (icmp->type != ICMP_ECHOREPLY)
+	  return;
+
+	target = &base->targets[slot];
+
+	/* Replies to a sweep already credited to the target (which then has a host) are duplicates */
+	if (target->host >= 0 && seq == target->lastseq)
+	  {
+	    /* One more foreign packet */
+	    base->foreign++;
+
+	    return;
+	  }
+
+	if (target->host < 0)
+	  {
+	    /* The reverse name is looked up only when needed */
+	    host = evhost_new(base, inet_ntoa(ip->ip_src), ip->ip_src, inet_ntoa(ip->ip_src));
+	    if (!host)
+	      return;
+	    host->range = 1;
+	    host->unresolved = 1;
+	    host->sentpkts = target->sent;
+	    host->firstsent = data->ts;
+	    host->lastsent = data->ts;
+	    host->user_callback = base->user_callback;
+	    host->user_pointer = base->user_pointer;
+	    target->host = host->index;
+
+	    base->responders++;
+	    base->rangemem += sizeof(struct evhost) + strlen(host->name) + strlen(host->fqname) + strlen(host->ipname) + 3;
+	  }
+	host = base->hosts[target->host];
+	target->lastseq = seq;
+
+	evutil_timersub(now, &data->ts, &elapsed);
+	evhost_replied(host, nrecv, now, &elapsed);
+
+	if (base->log)
+	  log_append(base->log, host, seq, PING_ERR_NONE, ip->ip_ttl, now, &elapsed);
+
+	/* The sweep is complete as soon as all the targets have replied */
+	if (seq == base->sweepseq && ++base->sweepreplies == base->ntargets && base->cursor == base->ntargets)
+	  {
+	    evping_timer_del(base, &base->sweep);
+	    sweep_done(base);
 	  }
 
+	if (host->user_callback)
+	  host->user_callback(PING_ERR_NONE, nrecv - IPHDR, host->fqname, host->ipname,
+			      seq, ip->ip_ttl, &elapsed, host->user_pointer);
+}
+
+
+/*
+ * The host a compact reply refers to, or NULL if it is not the reply to its outstanding request,
+ * that is unless it comes from the address of the host with the sequence of the request.
+ */
+static struct evhost *
+compact_host(struct evping_base *base, struct ip *ip, struct icmphdr *icmp)
+{
+	uint16_t high = (ntohs(icmp->un.echo.id) - COMPACT_ID_BASE(base->pid)) & 0xffff;
+	uint16_t seq = ntohs(icmp->un.echo.sequence);
+	struct evhost *host;
+
+	if (high >= COMPACT_MAX_HOSTS >> 8)
+	  return NULL;
+
+	host = evping_lookup_host(base, (high << 8) | (seq >> 8));
+	if (!host || host->saddr.sin_addr.s_addr != ip->ip_src.s_addr ||
+	    (seq & 0xff) != host->seq || !evping_timer_pending(&host->noreply_timer))
+	  return NULL;
+
+	return host;
+}
+
+
+/*
+ * Decode a packet received from the wire and relate ICMP Echo Request/Reply.
+ *
+ * To be legal the packet received must be:
+ *  o of enough size (> IPHDR + ICMP_MINLEN, and room for the user data unless compact)
+ *  o of ICMP Protocol
+ *  o of type ICMP_ECHOREPLY
+ *  o the one we are looking for (matching the same identifier of all the packets the program is able to send,
+ *    or for compact probes the address and the sequence of the request outstanding for the host it refers to)
+ *
+ * Our own Echo Requests are also seen by the raw socket when pinging a local address, so they are ignored here,
+ * as well as the copies of the replies read from a socket ('source', NULL for the default one) other than
+ * the one of the host.  It is shared by all the transports and must be called with the lock held.
+ */
+static void
+evping_reply(struct evping_base *base, struct evping_source *source, u_char *packet, int nrecv, struct timeval *now)
+{
+	/* Pointer to relevant portions of the packet (IP, ICMP and user data) */
+	struct ip * ip = (struct ip *) packet;
+	struct icmphdr * icmp;
+	struct evdata * data;
+	int hlen = 0;
+
+	struct evhost * host;
+	struct timeval sent;           /* Time the request was sent */
+	int seq;
+
+	ASSERT_LOCKED(base);
+
 	/* One more ICMP packect received */
 	base->recvok++;
 
@@ -408,218 +1641,2829 @@ static void ready_callback (int unused, const short event, void * arg)
 	    /* One more too short packet */
 	    base->tooshort++;
 
-	    goto done;
+	    return;
+	  }
+
+	/* The ICMP portion */
+	icmp = (struct icmphdr *) (packet + hlen);
+	data = (struct evdata *) (packet + hlen + ICMP_MINLEN);
+
+	/* Check the ICMP header to drop unexpected packets due to unrecognized id or looped back requests */
+	if ((icmp->un.echo.id != (0xffff & base->pid) && !base->compact) || icmp->type == ICMP_ECHO)
+	  {
+	    /* One more foreign packet */
+	    base->foreign++;
+
+	    return;
+	  }
+
+	if (icmp->un.echo.id != (0xffff & base->pid))
+	  {
+	    /* Compact probes, the send time is kept locally */
+	    host = compact_host(base, ip, icmp);
+	    if (!host)
+	      {
+		/* One more foreign packet, which may be a late or duplicate reply */
+		base->foreign++;
+
+		return;
+	      }
+	    sent = host->sendtime;
+	    seq = host->seq;
+	  }
+	else
+	  {
+	    /* The user data must be there */
+	    if (nrecv < hlen + ICMP_MINLEN + (int) MIN_DATA_SIZE)
+	      {
+		/* One more too short packet */
+		base->tooshort++;
+
+		return;
+	      }
+
+	    /* Replies to sweeps, which are sent from the default socket */
+	    if (data->index & RANGE_INDEX)
+	      {
+		if (source)
+		  base->foreign++;
+		else
+		  range_reply(base, ip, icmp, data, nrecv, now);
+		return;
+	      }
+
+	    /* Get the pointer to the host descriptor in our internal table, the 'index' portion must be legal */
+	    host = evping_lookup_host(base, data->index);
+	    if (!host)
+	      {
+		/* One more illegal packet */
+		base->illegal++;
+
+		return;
+	      }
+	    sent = data->ts;
+	    seq = ntohs(icmp->un.echo.sequence);
+
+	    /* Late or duplicate replies do not refer to the request outstanding for the host (none when replaying) */
+	    if (!base->replay && (seq != host->seq || !evping_timer_pending(&host->noreply_timer)))
+	      {
+		/* One more foreign packet */
+		base->foreign++;
+
+		return;
+	      }
+	  }
+
+	/* Every raw socket gets a copy of the replies, only the one the host is probed from counts */
+	if (host->source != source && !base->replay)
+	  {
+	    /* One more foreign packet */
+	    base->foreign++;
+
+	    return;
+	  }
+	if (source)
+	  source->replies++;
+
+	/* Check for Destination Host Unreachable */
+	if (icmp->type == ICMP_ECHOREPLY)
+	  {
+	    /* Use the User Data to relate Echo Request/Reply and evaluate the Round Trip Time */
+	    struct timeval elapsed;             /* response time */
+	    evping_callback_type callback = host->user_callback;
+	    void *ptr = host->user_pointer;
+
+	    /* Compute time difference to calculate the round trip */
+	    evutil_timersub (now, &sent, &elapsed);
+
+	    evhost_replied(host, nrecv, now, &elapsed);
+
+	    if (base->log)
+	      log_append(base->log, host, seq, PING_ERR_NONE, ip->ip_ttl, now, &elapsed);
+
+	    /* Update the sequence number for the next run */
+	    host->seq = (host->seq + 1) % 256;
+
+	    /* Clean the noreply timer */
+	    evping_timer_del(base, &host->noreply_timer);
+
+	    /* Add the timer to ping again the host at the given time interval */
+	    evhost_next(host);
+
+	    /* Last, so that the user can probe the host again */
+	    if (callback)
+	      callback(PING_ERR_NONE, nrecv - IPHDR, host->fqname, host->ipname, seq, ip->ip_ttl, &elapsed, ptr);
 	  }
+	else
+	  {
+	    /* Handle this condition exactly as the request has expired, which must then not expire again */
+	    evping_timer_del(base, &host->noreply_timer);
+	    noreply_callback (-1, -1, host);
+	  }
+}
+
+
+/* Pick the time the kernel received a packet and its count of drops up from the ancillary data */
+static void
+evping_ancillary(counter_t *kdrops, struct msghdr *msg, struct timeval *ts)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg))
+	  {
+	    if (cmsg->cmsg_level != SOL_SOCKET)
+	      continue;
+	    if (cmsg->cmsg_type == SCM_TIMESTAMP)
+	      memcpy(ts, CMSG_DATA(cmsg), sizeof(struct timeval));
+#ifdef SO_RXQ_OVFL
+	    else if (cmsg->cmsg_type == SO_RXQ_OVFL)
+	      {
+		uint32_t drops;
+		memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+		*kdrops = drops;                /* running total for the socket */
+	      }
+#endif
+	  }
+}
+
+
+/* Write a whole buffer, retrying on short writes */
+static void
+writer_write(int fd, const u_char *buf, size_t len)
+{
+	while (len)
+	  {
+	    ssize_t n = write(fd, buf, len);
+	    if (n < 0 && errno == EINTR)
+	      continue;
+	    if (n <= 0)
+	      return;
+	    buf += n;
+	    len -= n;
+	  }
+}
+
+
+/* The thread writing the buffers handed over by the loop */
+static void *
+writer_thread(void *arg)
+{
+	struct evping_writer *w = arg;
+
+	pthread_mutex_lock(&w->mutex);
+	for (;;)
+	  {
+	    while (!w->busy && !w->quit)
+	      pthread_cond_wait(&w->cond, &w->mutex);
+	    if (!w->busy)
+	      break;
+
+	    /* The loop does not touch the other buffer while busy */
+	    pthread_mutex_unlock(&w->mutex);
+	    writer_write(w->fd, w->buf[!w->active], w->fill[!w->active]);
+	    pthread_mutex_lock(&w->mutex);
+
+	    w->busy = 0;
+	    pthread_cond_broadcast(&w->cond);
+	  }
+	pthread_mutex_unlock(&w->mutex);
+
+	return NULL;
+}
+
+
+/* Hand the buffer being filled over to the thread, or return -1 if it is still busy with the other one */
+static int
+writer_flush(struct evping_writer *w)
+{
+	int res = -1;
+
+	pthread_mutex_lock(&w->mutex);
+	if (!w->busy)
+	  {
+	    w->busy = 1;
+	    w->active = !w->active;
+	    w->fill[w->active] = 0;
+	    pthread_cond_broadcast(&w->cond);
+	    res = 0;
+	  }
+	pthread_mutex_unlock(&w->mutex);
+
+	return res;
+}
+
+
+/* Append to the buffer being filled, 'len' must not be larger than WRITER_BUFFER */
+static void
+writer_append(struct evping_writer *w, const void *data, size_t len)
+{
+	if (w->fill[w->active] + len > WRITER_BUFFER && writer_flush(w) == -1)
+	  {
+	    w->drops += len;
+	    return;
+	  }
+	memcpy(w->buf[w->active] + w->fill[w->active], data, len);
+	w->fill[w->active] += len;
+}
+
+
+/* Write what is left, then stop the thread and close the file */
+static void
+writer_free(struct evping_writer *w)
+{
+	pthread_mutex_lock(&w->mutex);
+	while (w->busy)
+	  pthread_cond_wait(&w->cond, &w->mutex);
+	pthread_mutex_unlock(&w->mutex);
+
+	if (w->fill[w->active])
+	  writer_flush(w);
+
+	pthread_mutex_lock(&w->mutex);
+	w->quit = 1;
+	pthread_cond_broadcast(&w->cond);
+	pthread_mutex_unlock(&w->mutex);
+
+	pthread_join(w->thread, NULL);
+	close(w->fd);
+
+	pthread_cond_destroy(&w->cond);
+	pthread_mutex_destroy(&w->mutex);
+	mm_free(w->buf[0]);
+	mm_free(w->buf[1]);
+	mm_free(w);
+}
+
+
+/* Take a file opened for writing over, or return NULL in the event of error (the file is closed) */
+static struct evping_writer *
+writer_new(int fd)
+{
+	struct evping_writer *w = mm_calloc(1, sizeof(struct evping_writer));
+
+	if (!w)
+	  goto fail;
+	w->fd = fd;
+	w->buf[0] = mm_malloc(WRITER_BUFFER);
+	w->buf[1] = mm_malloc(WRITER_BUFFER);
+	if (!w->buf[0] || !w->buf[1])
+	  goto fail;
+
+	pthread_mutex_init(&w->mutex, NULL);
+	pthread_cond_init(&w->cond, NULL);
+	if (pthread_create(&w->thread, NULL, writer_thread, w))
+	  {
+	    pthread_cond_destroy(&w->cond);
+	    pthread_mutex_destroy(&w->mutex);
+	    goto fail;
+	  }
+	return w;
+
+fail:
+	if (w)
+	  {
+	    mm_free(w->buf[0]);
+	    mm_free(w->buf[1]);
+	    mm_free(w);
+	  }
+	close(fd);
+	return NULL;
+}
+
+
+/* Create a pcap file to record the packets received, or return NULL in the event of error */
+static struct evping_writer *
+pcap_new(const char *filename)
+{
+	struct pcap_file_header hdr;
+	struct evping_writer *w;
+	int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd == -1 || !(w = writer_new(fd)))
+	  return NULL;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = PCAP_MAGIC;
+	hdr.version_major = 2;
+	hdr.version_minor = 4;
+	hdr.snaplen = PCAP_SNAPLEN;
+	hdr.linktype = PCAP_LINKTYPE_RAW;
+	writer_append(w, &hdr, sizeof(hdr));
+
+	return w;
+}
+
+
+/* Record a packet along with the time it has been received */
+static void
+pcap_record(struct evping_writer *w, const u_char *packet, int len, const struct timeval *ts)
+{
+	struct pcap_rec_header rec;
+
+	rec.ts_sec = ts->tv_sec;
+	rec.ts_usec = ts->tv_usec;
+	rec.incl_len = len;
+	rec.orig_len = len;
+	writer_append(w, &rec, sizeof(rec));
+	writer_append(w, packet, len);
+}
+
+
+/* Keep track of the time a packet waited before being processed and pass it to evping_reply() */
+static void
+evping_received(struct evping_base *base, struct evping_source *source, u_char *packet, int nrecv, struct timeval *ts)
+{
+	struct timeval now;
+	struct timeval delay;
+
+	evping_now(base, &now);
+	evutil_timersub(&now, ts, &delay);
+	histogram_add(&base->delay, tvtousecs(&delay));
+
+	if (base->pcap)
+	  pcap_record(base->pcap, packet, nrecv, ts);
+
+	evping_reply(base, source, packet, nrecv, ts);
+}
+
+
+/* The next pseudo random number of the simulation (xorshift64*) */
+static uint64_t
+sim_random(struct evping_sim *sim)
+{
+	sim->seed ^= sim->seed >> 12;
+	sim->seed ^= sim->seed << 25;
+	sim->seed ^= sim->seed >> 27;
+	return sim->seed * 0x2545f4914f6cdd1dULL;
+}
+
+
+/* The reply of the simulated responder is due, as if it was read from the socket of its source */
+static void sim_reply_callback(int unused, const short event, void *arg)
+{
+	struct evping_sim_reply *reply = arg;
+	struct evping_base *base = reply->base;
+	struct evping_sim *sim = base->sim;
+
+	EVPING_LOCK(base);
+
+	if (reply->source)
+	  reply->source->recvok++;
+	evping_received(base, reply->source, reply->packet, reply->len, &sim->now);
+
+	reply->next = sim->free;
+	sim->free = reply;
+
+	EVPING_UNLOCK(base);
+}
+
+
+/*
+ * Hand an ICMP Echo Request to the simulated responder in place of sendto(), which
+ * turns it into an Echo Reply from the address it was sent to, due after the round trip
+ * time and a random share of the jitter.  The dead hosts are chosen by their addresses,
+ * so that they are the same ones at each request.  It returns 'size' as sendto() would,
+ * or -1 in the event of error.
+ */
+static int
+sim_transmit(struct evping_base *base, struct evping_source *source, const struct sockaddr_in *to,
+	     const u_char *packet, int size)
+{
+	struct evping_sim *sim = base->sim;
+	struct evping_sim_reply *reply;
+	struct ip *ip;
+	struct icmp *icmp;
+	struct timeval rtt;
+	uint32_t addr = ntohl(to->sin_addr.s_addr);
+	int64_t usecs;
+
+	if (((addr * 2654435761U) >> 16) % 100 < sim->dead || sim_random(sim) % 100 < sim->loss)
+	  {
+	    sim->lost++;
+	    return size;
+	  }
+
+	/* A reply is taken from those free, large enough for the packet */
+	if ((reply = sim->free))
+	  sim->free = reply->next;
+	else if ((reply = mm_calloc(1, sizeof(struct evping_sim_reply))))
+	  {
+	    reply->base = base;
+	    evping_timer_assign(base, &reply->timer, sim_reply_callback, reply);
+	  }
+	else
+	  return -1;
+	if (reply->size < IPHDR + size)
+	  {
+	    u_char *more = mm_realloc(reply->packet, IPHDR + size);
+	    if (!more)
+	      {
+		reply->next = sim->free;
+		sim->free = reply;
+		return -1;
+	      }
+	    reply->packet = more;
+	    reply->size = IPHDR + size;
+	  }
+	reply->source = source;
+	reply->len = IPHDR + size;
+
+	/* The IP header of the reply, as the kernel passes it to raw sockets */
+	ip = (struct ip *) reply->packet;
+	memset(ip, 0, IPHDR);
+	ip->ip_v = 4;
+	ip->ip_hl = IPHDR / 4;
+	ip->ip_len = htons(IPHDR + size);
+	ip->ip_ttl = 64;
+	ip->ip_p = IPPROTO_ICMP;
+	ip->ip_src = to->sin_addr;
+	ip->ip_dst.s_addr = htonl(INADDR_LOOPBACK);
+
+	/* The request echoed back */
+	icmp = (struct icmp *) (reply->packet + IPHDR);
+	memcpy(icmp, packet, size);
+	icmp->icmp_type = ICMP_ECHOREPLY;
+	icmp->icmp_cksum = 0;
+	icmp->icmp_cksum = mkcksum((u_short *) icmp, size);
+
+	usecs = sim->rtt + (sim->jitter ? sim_random(sim) % (sim->jitter + 1) : 0);
+	rtt.tv_sec = usecs / 1000000;
+	rtt.tv_usec = usecs % 1000000;
+	if (sim_add(sim, &reply->timer, &rtt) == -1)
+	  {
+	    reply->next = sim->free;
+	    sim->free = reply;
+	    return -1;
+	  }
+
+	return size;
+}
+
+
+/* Start simulating at the current time, with a responder replying in 1 msec */
+static struct evping_sim *
+sim_new(void)
+{
+	struct evping_sim *sim = mm_calloc(1, sizeof(struct evping_sim));
+
+	if (!sim)
+	  return NULL;
+	gettimeofday(&sim->now, NULL);
+	sim->rtt = 1000;
+	sim->seed = 0x9e3779b97f4a7c15ULL;       /* Runs are repeatable unless told otherwise */
+
+	return sim;
+}
+
+
+/* Release the virtual clock along with the replies of the simulated responder still due */
+static void
+sim_free(struct evping_sim *sim)
+{
+	struct evping_sim_reply *reply;
+
+	while (sim->ntimers)
+	  {
+	    struct evping_timer *t = sim->heap[0];
+	    sim_remove(sim, t);
+	    if (event_get_callback(&t->event) != (event_callback_fn) sim_reply_callback)
+	      continue;
+	    reply = event_get_callback_arg(&t->event);
+	    reply->next = sim->free;
+	    sim->free = reply;
+	  }
+
+	while ((reply = sim->free))
+	  {
+	    sim->free = reply->next;
+	    mm_free(reply->packet);
+	    mm_free(reply);
+	  }
+
+	mm_free(sim->heap);
+	mm_free(sim);
+}
+
+
+static void replay_callback(int unused, const short event, void *arg);
+
+
+/* The record at the given offset of a capture, or NULL at its end */
+static struct pcap_rec_header *
+replay_record(struct evping_replay *r, size_t off, struct timeval *ts)
+{
+	struct pcap_rec_header *rec = (struct pcap_rec_header *) (r->map + off);
+
+	if (off + sizeof(*rec) > r->size || rec->incl_len > PCAP_SNAPLEN || off + sizeof(*rec) + rec->incl_len > r->size)
+	  return NULL;
+	ts->tv_sec = rec->ts_sec;
+	ts->tv_usec = r->nsecs ? rec->ts_usec / 1000 : rec->ts_usec;
+	return rec;
+}
+
+
+/* Feed the next packet of a capture to the receive path, or return -1 at its end */
+static int
+replay_one(struct evping_base *base, struct evping_replay *r)
+{
+	u_char packet[PCAP_SNAPLEN];
+	struct timeval ts;
+	struct pcap_rec_header *rec = replay_record(r, r->off, &ts);
+
+	if (!rec)
+	  return -1;
+
+	/* Copied as the packet would have been received, also to have it aligned */
+	memcpy(packet, rec + 1, rec->incl_len);
+	r->off += sizeof(*rec) + rec->incl_len;
+	r->packets++;
+
+	evping_reply(base, NULL, packet, rec->incl_len, &ts);
+	return 0;
+}
+
+
+/*
+ * Map a capture in memory to replay it.
+ *
+ * The identifier of the requests is taken from the first Echo Reply, and
+ * when no host has been added the hosts are created from the capture, each
+ * one with the address of the replies carrying its index.
+ */
+static struct evping_replay *
+replay_new(struct evping_base *base, const char *filename)
+{
+	struct evping_replay *r;
+	struct pcap_file_header *hdr;
+	struct pcap_rec_header *rec;
+	struct in_addr *addrs = NULL;
+	uint32_t naddrs = 0;
+	struct timeval ts;
+	struct stat st;
+	size_t off;
+	int idset = 0;
+	int fd;
+
+	ASSERT_LOCKED(base);
+
+	if ((fd = open(filename, O_RDONLY)) == -1)
+	  return NULL;
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(*hdr) || !(r = mm_calloc(1, sizeof(*r))))
+	  {
+	    close(fd);
+	    return NULL;
+	  }
+	r->size = st.st_size;
+	r->map = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (r->map == MAP_FAILED)
+	  {
+	    mm_free(r);
+	    return NULL;
+	  }
+
+	hdr = (struct pcap_file_header *) r->map;
+	if ((hdr->magic != PCAP_MAGIC && hdr->magic != PCAP_MAGIC_NSEC) || hdr->linktype != PCAP_LINKTYPE_RAW)
+	  goto fail;
+	r->nsecs = hdr->magic == PCAP_MAGIC_NSEC;
+	r->off = sizeof(*hdr);
+
+	/* A first pass to learn the identifier and the addresses of the hosts */
+	for (off = r->off; (rec = replay_record(r, off, &ts)); off += sizeof(*rec) + rec->incl_len)
+	  {
+	    struct ip *ip = (struct ip *) (rec + 1);
+	    struct icmphdr *icmp;
+	    struct evdata *data;
+	    uint32_t index;
+
+	    if (off == r->off)
+	      r->first = ts;
+
+	    /* The IP header must be there before its length is looked at */
+	    if (rec->incl_len < sizeof(struct ip) || ip->ip_hl < 5 ||
+		rec->incl_len < ip->ip_hl * 4 + ICMP_MINLEN + MIN_DATA_SIZE)
+	      continue;
+	    icmp = (struct icmphdr *) ((u_char *) ip + ip->ip_hl * 4);
+	    data = (struct evdata *) ((u_char *) icmp + ICMP_MINLEN);
+	    if (icmp->type != ICMP_ECHOREPLY)
+	      continue;
+	    if (!idset)
+	      {
+		base->pid = icmp->un.echo.id;
+		idset = 1;
+	      }
+	    memcpy(&index, &data->index, sizeof(index));
+	    if (base->argc || icmp->un.echo.id != (0xffff & base->pid) || index & RANGE_INDEX || index >= (1 << 24))
+	      continue;
+
+	    if (index >= naddrs)
+	      {
+		uint32_t n = MAX(index + 1, 2 * naddrs);
+		struct in_addr *more = mm_realloc(addrs, n * sizeof(struct in_addr));
+		if (!more)
+		  goto fail;
+		memset(more + naddrs, 0, (n - naddrs) * sizeof(struct in_addr));
+		addrs = more;
+		naddrs = n;
+	      }
+	    addrs[index] = ip->ip_src;
+	  }
+
+	while (base->argc < naddrs)
+	  if (!evhost_new(base, inet_ntoa(addrs[base->argc]), addrs[base->argc], inet_ntoa(addrs[base->argc])))
+	    goto fail;
+	mm_free(addrs);
+
+	evping_timer_assign(base, &r->timer, replay_callback, base);
+
+	return r;
+
+fail:
+	mm_free(addrs);
+	munmap(r->map, r->size);
+	mm_free(r);
+	return NULL;
+}
+
+
+static void
+replay_free(struct evping_base *base, struct evping_replay *r)
+{
+	evping_timer_del(base, &r->timer);
+	munmap(r->map, r->size);
+	mm_free(r);
+}
+
+
+/* Feed the packets which are due, all of them unless paced, and notify the user at the end of the capture */
+static void replay_callback(int unused, const short event, void *arg)
+{
+	struct evping_base *base = arg;
+	struct evping_replay *r;
+	struct timeval now;
+	struct timeval elapsed;
+	struct timeval ts;
+	struct timeval offset;
+
+	EVPING_LOCK(base);
+	r = base->replay;
+
+	evping_now(base, &now);
+	evutil_timersub(&now, &r->start, &elapsed);
+
+	for (;;)
+	  {
+	    if (!replay_record(r, r->off, &ts))
+	      {
+		/* The end, see done_callback() */
+		struct timeval asap = { 0, 0 };
+		evping_timer_add(base, &base->done, &asap);
+		break;
+	      }
+
+	    evutil_timersub(&ts, &r->first, &offset);
+	    if (r->paced && evutil_timercmp(&offset, &elapsed, >))
+	      {
+		struct timeval wait;
+		evutil_timersub(&offset, &elapsed, &wait);
+		evping_timer_add(base, &r->timer, &wait);
+		break;
+	      }
+
+	    replay_one(base, r);
+	  }
+
+	EVPING_UNLOCK(base);
+}
+
+
+/* Sample the depth of the receive queue of the raw socket once every RXQ_SAMPLING read events */
+static void
+evping_sample_queue(struct evping_base *base)
+{
+	int queued = 0;
+
+	if (base->revents++ % RXQ_SAMPLING)
+	  return;
+
+#if defined(SO_MEMINFO) && defined(EVPING_HAVE_SK_MEMINFO)
+	/* SIOCINQ only reports the size of the next datagram on raw sockets, so ask for the memory held by the queue */
+	{
+	  uint32_t meminfo[SK_MEMINFO_VARS];
+	  socklen_t len = sizeof(meminfo);
+
+	  if (getsockopt(base->rawfd, SOL_SOCKET, SO_MEMINFO, meminfo, &len) == 0)
+	    {
+	      histogram_add(&base->rxqueue, meminfo[SK_MEMINFO_RMEM_ALLOC]);
+	      return;
+	    }
+	}
+#endif
+	if (ioctl(base->rawfd, SIOCINQ, &queued) == 0)
+	  histogram_add(&base->rxqueue, queued);
+}
+
+
+#ifdef EVPING_HAVE_IO_URING
+
+/*
+ * The io_uring transport.
+ *
+ * A multishot receive is kept posted on the raw socket and it picks its buffers
+ * from a ring provided to the kernel, so that a single submission returns any number
+ * of Echo Replies without further system calls.  Requests are formatted in place into
+ * preallocated send slots registered with the ring, and all the submissions queued
+ * during a loop iteration are handed to the kernel at once.  Completions are signalled
+ * via an eventfd which is monitored by the event base like any other descriptor.
+ */
+
+static int
+uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+
+static int
+uring_enter(int fd, unsigned to_submit)
+{
+	return (int) syscall(__NR_io_uring_enter, fd, to_submit, 0, 0, NULL, 0);
+}
+
+
+static int
+uring_register(int fd, unsigned opcode, void *arg, unsigned nargs)
+{
+	return (int) syscall(__NR_io_uring_register, fd, opcode, arg, nargs);
+}
+
+
+/* Publish all the queued submissions and notify the kernel */
+static void
+uring_submit(struct evping_uring *u)
+{
+	unsigned pending = u->sq_local - *u->sq_tail;
+
+	if (!pending)
+	  return;
+
+	__atomic_store_n(u->sq_tail, u->sq_local, __ATOMIC_RELEASE);
+	uring_enter(u->ringfd, pending);
+}
+
+
+/* Get a free submission queue entry (the queue is flushed when full) */
+static struct io_uring_sqe *
+uring_get_sqe(struct evping_uring *u)
+{
+	struct io_uring_sqe *sqe;
+
+	if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+	  {
+	    uring_submit(u);
+	    if (u->sq_local - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+	      return NULL;
+	  }
+
+	sqe = &u->sqes[u->sq_local & u->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	u->sq_local++;
+
+	return sqe;
+}
+
+
+/* Schedule the submission of the queued entries at the end of the current loop iteration */
+static void
+uring_schedule(struct evping_uring *u)
+{
+	if (!u->flushing)
+	  {
+	    u->flushing = 1;
+	    event_active(&u->flush, EV_TIMEOUT, 1);
+	  }
+}
+
+
+/* Post the multishot receive on the raw socket */
+static int
+uring_recv(struct evping_base *base)
+{
+	struct evping_uring *u = base->uring;
+	struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+	if (!sqe)
+	  return -1;
+
+	sqe->opcode    = IORING_OP_RECVMSG;
+	sqe->fd        = base->rawfd;
+	sqe->addr      = (uintptr_t) &u->rmsg;
+	sqe->len       = 1;
+	sqe->ioprio    = IORING_RECV_MULTISHOT;
+	sqe->flags     = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BGID;
+	sqe->user_data = URING_RECV_TAG;
+
+	uring_schedule(u);
+	return 0;
+}
+
+
+/* Give a receive buffer back to the kernel (it is visible once the ring tail is published) */
+static void
+uring_recycle(struct evping_uring *u, unsigned short bid)
+{
+	struct io_uring_buf *buf = &u->br->bufs[u->br_tail & (URING_RECV_BUFS - 1)];
+
+	buf->addr = (uintptr_t) (u->rbufs + bid * u->rbuf_size);
+	buf->len  = u->rbuf_size;
+	buf->bid  = bid;
+	u->br_tail++;
+}
+
+
+/* Queue the transmission of a send slot */
+static int
+uring_transmit(struct evping_base *base, int n)
+{
+	struct evping_uring *u = base->uring;
+	struct evping_uring_slot *slot = &u->slots[n];
+	struct io_uring_sqe *sqe = uring_get_sqe(u);
+
+	if (!sqe)
+	  return -1;
+
+	slot->zc = !u->nozc;
+	if (slot->zc)
+	  {
+	    /* Zero-copy transmission from the registered area */
+	    sqe->opcode    = IORING_OP_SEND_ZC;
+	    sqe->ioprio    = IORING_RECVSEND_FIXED_BUF;
+	    sqe->buf_index = 0;
+	    sqe->addr      = (uintptr_t) slot->buffer;
+	    sqe->len       = slot->iov.iov_len;
+	    sqe->addr2     = (uintptr_t) &slot->to;
+	    sqe->addr_len  = sizeof(struct sockaddr_in);
+	  }
+	else
+	  {
+	    sqe->opcode = IORING_OP_SENDMSG;
+	    sqe->addr   = (uintptr_t) &slot->msg;
+	    sqe->len    = 1;
+	  }
+	sqe->fd        = base->rawfd;
+	sqe->msg_flags = MSG_DONTWAIT;
+	sqe->user_data = n + 1;
+
+	slot->refs++;
+	uring_schedule(u);
+	return 0;
+}
+
+
+/* Format an ICMP Echo Request into a free send slot and queue it for transmission */
+static int
+uring_send(struct evping_base *base, struct evhost *host)
+{
+	struct evping_uring *u = base->uring;
+	struct evping_uring_slot *slot;
+	int n = u->freeslot;
+
+	if (n < 0)
+	  return -1;
+
+	slot = &u->slots[n];
+	evhost_fmticmp(base, host, slot->buffer);
+	slot->iov.iov_len = base->pktsize;
+	slot->to = host->saddr;
+	slot->host = host->index;
+
+	if (uring_transmit(base, n) == -1)
+	  return -1;
+
+	u->freeslot = slot->next;
+	return base->pktsize;
+}
+
+
+/* Handle the completion of a transmission */
+static void
+uring_sent(struct evping_base *base, struct io_uring_cqe *cqe)
+{
+	struct evping_uring *u = base->uring;
+	int n = cqe->user_data - 1;
+	struct evping_uring_slot *slot = &u->slots[n];
+	struct evhost *host;
+
+	if (!(cqe->flags & IORING_CQE_F_NOTIF) && cqe->res < 0)
+	  {
+	    /* Raw sockets may not support zero-copy transmissions, so fall back to sendmsg() from now on */
+	    if (slot->zc && cqe->res == -EOPNOTSUPP)
+	      {
+		u->nozc = 1;
+		if (uring_transmit(base, n) == 0)
+		  goto release;
+	      }
+
+	    /* The request was counted as sent at the time it was queued */
+	    host = base->hosts[slot->host];
+	    base->sentok--;
+	    base->sendfail++;
+	    if (host->source)
+	      {
+		host->source->sentok--;
+		host->source->sendfail++;
+	      }
+	    host->sentpkts--;
+	    host->sentbytes -= slot->iov.iov_len;
+	    if (host->group)
+	      host->group->sentpkts--;
+	  }
+
+release:
+	/* The slot can be reused once all its requests have been completed (including zero-copy notifications) */
+	if (!(cqe->flags & IORING_CQE_F_MORE) && !--slot->refs)
+	  {
+	    slot->next = u->freeslot;
+	    u->freeslot = n;
+	  }
+}
+
+
+/* Called by libevent at the end of each loop iteration in which submissions have been queued */
+static void
+uring_flush_callback(int unused, const short event, void *arg)
+{
+	struct evping_base *base = arg;
+
+	EVPING_LOCK(base);
+	if (base->uring)
+	  {
+	    base->uring->flushing = 0;
+	    uring_submit(base->uring);
+	  }
+	EVPING_UNLOCK(base);
+}
+
+
+/* Called by libevent when the kernel signals completions on the eventfd */
+static void
+uring_callback(int fd, const short event, void *arg)
+{
+	struct evping_base *base = arg;
+	struct evping_uring *u;
+	uint64_t val;
+	unsigned head;
+	unsigned tail;
+	int rearm = 0;
+
+	if (read(fd, &val, sizeof(val)) < 0 && errno != EAGAIN)
+	  return;
+
+	EVPING_LOCK(base);
+	u = base->uring;
+	if (!u)
+	  goto done;
+
+	head = *u->cq_head;
+	tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail)
+	  {
+	    struct io_uring_cqe *cqe = &u->cqes[head & u->cq_mask];
+
+	    if (cqe->user_data != URING_RECV_TAG)
+	      uring_sent(base, cqe);
+	    else
+	      {
+		if (cqe->res >= 0 && (cqe->flags & IORING_CQE_F_BUFFER))
+		  {
+		    unsigned short bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+		    u_char *buffer = u->rbufs + bid * u->rbuf_size;
+		    struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *) buffer;
+		    struct msghdr msg;
+		    struct timeval ts;
+		    int hlen = sizeof(*out) + u->rmsg.msg_namelen + u->rmsg.msg_controllen;
+
+		    /* Each buffer holds a header, the ancillary data and the packet */
+		    memset(&msg, 0, sizeof(msg));
+		    msg.msg_control = buffer + sizeof(*out) + u->rmsg.msg_namelen;
+		    msg.msg_controllen = out->controllen;
+
+		    /* Time the packet has been received (by the kernel if known) */
+		    gettimeofday(&ts, NULL);
+		    evping_ancillary(&base->kdrops, &msg, &ts);
+
+		    evping_received(base, NULL, buffer + hlen, MIN((int) out->payloadlen, cqe->res - hlen), &ts);
+		    uring_recycle(u, bid);
+		  }
+		else if (cqe->res != -ENOBUFS)
+		  base->recvfail++;
+
+		/* The kernel stopped the multishot receive (e.g. out of buffers), post it again */
+		if (!(cqe->flags & IORING_CQE_F_MORE))
+		  rearm = 1;
+	      }
+
+	    head++;
+	    tail = head != tail ? tail : __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+	  }
+	__atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+	/* Publish the recycled buffers */
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+
+	if (rearm)
+	  uring_recv(base);
+
+	evping_sample_queue(base);
+
+done:
+	EVPING_UNLOCK(base);
+}
+
+
+/* Release all the resources of the io_uring transport */
+static void
+uring_free(struct evping_uring *u)
+{
+	if (event_initialized(&u->event))
+	  event_del(&u->event);
+	if (event_initialized(&u->flush))
+	  event_del(&u->flush);
+
+	/* Closing the instance also cancels the multishot receive and unregisters everything */
+	if (u->ringfd >= 0)
+	  close(u->ringfd);
+	if (u->efd >= 0)
+	  close(u->efd);
+
+	if (u->sqes)
+	  munmap(u->sqes, u->sqes_sz);
+	if (u->cqring && u->cqring != u->sqring)
+	  munmap(u->cqring, u->cqring_sz);
+	if (u->sqring)
+	  munmap(u->sqring, u->sqring_sz);
+	if (u->br)
+	  munmap(u->br, u->br_sz);
+
+	mm_free(u->rbufs);
+	mm_free(u->sbufs);
+	mm_free(u);
+}
+
+
+/* Create the io_uring transport, or return NULL in the event the running kernel does not support it */
+static struct evping_uring *
+uring_new(struct evping_base *base)
+{
+	struct io_uring_params p;
+	struct io_uring_buf_reg reg;
+	struct iovec area;
+	struct evping_uring *u;
+	u_char *sq;
+	u_char *cq;
+	int i;
+
+	u = mm_calloc(1, sizeof(struct evping_uring));
+	if (!u)
+	  return NULL;
+	u->ringfd = u->efd = -1;
+
+	memset(&p, 0, sizeof(p));
+	p.flags = IORING_SETUP_CQSIZE;
+	p.cq_entries = URING_CQ_ENTRIES;
+	if ((u->ringfd = uring_setup(URING_ENTRIES, &p)) < 0)
+	  goto fail;
+
+	/* Map the submission and completion queues */
+	u->sqring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cqring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	  u->sqring_sz = u->cqring_sz = MAX(u->sqring_sz, u->cqring_sz);
+
+	u->sqring = mmap(NULL, u->sqring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ringfd, IORING_OFF_SQ_RING);
+	if (u->sqring == MAP_FAILED)
+	  {
+	    u->sqring = NULL;
+	    goto fail;
+	  }
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+	  u->cqring = u->sqring;
+	else
+	  {
+	    u->cqring = mmap(NULL, u->cqring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ringfd, IORING_OFF_CQ_RING);
+	    if (u->cqring == MAP_FAILED)
+	      {
+		u->cqring = NULL;
+		goto fail;
+	      }
+	  }
+	u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = mmap(NULL, u->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->ringfd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED)
+	  {
+	    u->sqes = NULL;
+	    goto fail;
+	  }
+
+	sq = u->sqring;
+	cq = u->cqring;
+	u->sq_head    = (unsigned *) (sq + p.sq_off.head);
+	u->sq_tail    = (unsigned *) (sq + p.sq_off.tail);
+	u->sq_mask    = * (unsigned *) (sq + p.sq_off.ring_mask);
+	u->sq_entries = * (unsigned *) (sq + p.sq_off.ring_entries);
+	u->sq_local   = *u->sq_tail;
+	u->cq_head    = (unsigned *) (cq + p.cq_off.head);
+	u->cq_tail    = (unsigned *) (cq + p.cq_off.tail);
+	u->cq_mask    = * (unsigned *) (cq + p.cq_off.ring_mask);
+	u->cqes       = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+	/* Submission entries are always used in order */
+	for (i = 0; i < (int) u->sq_entries; i++)
+	  ((unsigned *) (sq + p.sq_off.array)) [i] = i;
+
+	/* Provide the kernel with the buffers for the multishot receive (room enough for an IP header with options) */
+	u->rmsg.msg_controllen = CMSG_SPACE(sizeof(struct timeval)) + CMSG_SPACE(sizeof(uint32_t));
+	u->rbuf_size = (sizeof(struct io_uring_recvmsg_out) + u->rmsg.msg_controllen + base->pktsize + 60 + 63) & ~63;
+	u->br_sz = URING_RECV_BUFS * sizeof(struct io_uring_buf);
+	u->br = mmap(NULL, u->br_sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (u->br == MAP_FAILED)
+	  {
+	    u->br = NULL;
+	    goto fail;
+	  }
+	if (!(u->rbufs = mm_malloc(URING_RECV_BUFS * u->rbuf_size)))
+	  goto fail;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr    = (uintptr_t) u->br;
+	reg.ring_entries = URING_RECV_BUFS;
+	reg.bgid         = URING_BGID;
+	if (uring_register(u->ringfd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+	  goto fail;
+
+	for (i = 0; i < URING_RECV_BUFS; i++)
+	  uring_recycle(u, i);
+	__atomic_store_n(&u->br->tail, u->br_tail, __ATOMIC_RELEASE);
+
+	/* Allocate and register the send slots */
+	u->sbuf_size = (base->pktsize + 63) & ~63;
+	if (!(u->sbufs = mm_calloc(URING_ENTRIES, u->sbuf_size)))
+	  goto fail;
+
+	area.iov_base = u->sbufs;
+	area.iov_len  = URING_ENTRIES * u->sbuf_size;
+	if (uring_register(u->ringfd, IORING_REGISTER_BUFFERS, &area, 1) < 0)
+	  u->nozc = 1;
+
+	for (i = 0; i < URING_ENTRIES; i++)
+	  {
+	    struct evping_uring_slot *slot = &u->slots[i];
+
+	    slot->buffer = u->sbufs + i * u->sbuf_size;
+	    slot->iov.iov_base = slot->buffer;
+	    slot->msg.msg_name = &slot->to;
+	    slot->msg.msg_namelen = sizeof(struct sockaddr_in);
+	    slot->msg.msg_iov = &slot->iov;
+	    slot->msg.msg_iovlen = 1;
+	    slot->next = i + 1 < URING_ENTRIES ? i + 1 : -1;
+	  }
+	u->freeslot = 0;
+
+	/* Completions are notified via an eventfd monitored by the event base */
+	if ((u->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+	  goto fail;
+	if (uring_register(u->ringfd, IORING_REGISTER_EVENTFD, &u->efd, 1) < 0)
+	  goto fail;
+
+	event_assign(&u->event, base->event_base, u->efd, EV_READ | EV_PERSIST, uring_callback, base);
+	evtimer_assign(&u->flush, base->event_base, uring_flush_callback, base);
+	event_add(&u->event, NULL);
+
+	return u;
+
+fail:
+	uring_free(u);
+	return NULL;
+}
+
+#endif /* EVPING_HAVE_IO_URING */
+
+
+#ifdef EVPING_HAVE_PACKET_RING
+
+/*
+ * The receive path via a memory-mapped TPACKET_V3 ring.
+ *
+ * An AF_PACKET socket bound to a single interface shares a ring of blocks with
+ * the kernel and a BPF program lets only the Echo Replies carrying our identifier
+ * in.  The kernel hands a block over when it is full or after RING_BLOCK_TOV msecs,
+ * and all the replies it holds are decoded in place, without any copy or system call.
+ * The round trip is evaluated against the time the kernel has stored in the frame.
+ */
+
+/* Called by libevent when at least one block of the ring has been retired by the kernel */
+static void
+ring_callback(int unused, const short event, void *arg)
+{
+	struct evping_base *base = arg;
+	struct evping_ring *r;
+
+	EVPING_LOCK(base);
+	r = base->ring;
+	if (!r)
+	  goto done;
+
+	for (;;)
+	  {
+	    struct tpacket_block_desc *block = (struct tpacket_block_desc *) (r->map + r->cur * RING_BLOCK_SIZE);
+	    struct tpacket3_hdr *frame;
+	    unsigned n;
+
+	    if (!(__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+	      break;
+
+	    frame = (struct tpacket3_hdr *) ((u_char *) block + block->hdr.bh1.offset_to_first_pkt);
+	    for (n = 0; n < block->hdr.bh1.num_pkts; n++)
+	      {
+		struct timeval ts;
+
+		/* Time the packet has been received as recorded by the kernel */
+		ts.tv_sec  = frame->tp_sec;
+		ts.tv_usec = frame->tp_nsec / 1000;
+
+		evping_received(base, NULL, (u_char *) frame + frame->tp_net, frame->tp_snaplen, &ts);
+
+		frame = (struct tpacket3_hdr *) ((u_char *) frame + frame->tp_next_offset);
+	      }
+
+	    /* Give the block back to the kernel */
+	    __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+	    r->cur = (r->cur + 1) % RING_BLOCK_NR;
+	  }
+
+done:
+	EVPING_UNLOCK(base);
+}
+
+
+/* Release all the resources of the packet ring */
+static void
+ring_free(struct evping_ring *r)
+{
+	if (event_initialized(&r->event))
+	  event_del(&r->event);
+	if (r->map)
+	  munmap(r->map, r->map_sz);
+	if (r->fd >= 0)
+	  close(r->fd);
+	mm_free(r);
+}
+
+
+/* Create the packet ring on the given interface, or return NULL in the event of error */
+static struct evping_ring *
+ring_new(struct evping_base *base, const char *ifname)
+{
+	uint16_t id = ntohs(0xffff & base->pid);      /* as loaded by BPF_H */
+	struct sock_filter code [] = {
+		BPF_STMT(BPF_LD  + BPF_B   + BPF_ABS, 9),                    /* IP protocol           */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,   IPPROTO_ICMP, 0, 11),
+		BPF_STMT(BPF_LD  + BPF_H   + BPF_ABS, 6),                    /* IP fragment offset    */
+		BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K,  0x1fff, 9, 0),
+		BPF_STMT(BPF_LDX + BPF_B   + BPF_MSH, 0),                    /* IP header length      */
+		BPF_STMT(BPF_LD  + BPF_B   + BPF_IND, 0),                    /* ICMP type             */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,   ICMP_ECHOREPLY, 0, 6),
+		BPF_STMT(BPF_LD  + BPF_H   + BPF_IND, 4),                    /* ICMP identifier       */
+		BPF_JUMP(BPF_JMP + BPF_JEQ + BPF_K,   id, 3, base->compact ? 0 : 4),
+		BPF_STMT(BPF_ALU + BPF_SUB + BPF_K,   COMPACT_ID_BASE(base->pid)),  /* Compact probes  */
+		BPF_STMT(BPF_ALU + BPF_AND + BPF_K,   0xffff),
+		BPF_JUMP(BPF_JMP + BPF_JSET + BPF_K,  0x8000, 1, 0),
+		BPF_STMT(BPF_RET + BPF_K,             IP_MAXPACKET),
+		BPF_STMT(BPF_RET + BPF_K,             0),
+	};
+	struct sock_fprog filter = { sizeof(code) / sizeof(code[0]), code };
+	struct tpacket_req3 req;
+	struct sockaddr_ll sll;
+	struct evping_ring *r;
+	int version = TPACKET_V3;
+	int one = 1;
+
+	r = mm_calloc(1, sizeof(struct evping_ring));
+	if (!r)
+	  return NULL;
+
+	/* Replies are read starting from the IP header (the link layer is removed by the kernel) */
+	if ((r->fd = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) == -1)
+	  goto fail;
+
+	if (setsockopt(r->fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) == -1 ||
+	    setsockopt(r->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1 ||
+	    setsockopt(r->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one)) == -1)
+	  goto fail;
+
+	memset(&req, 0, sizeof(req));
+	req.tp_block_size = RING_BLOCK_SIZE;
+	req.tp_block_nr = RING_BLOCK_NR;
+	req.tp_frame_size = RING_FRAME_SIZE;
+	req.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCK_NR;
+	req.tp_retire_blk_tov = RING_BLOCK_TOV;
+	if (setsockopt(r->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+	  goto fail;
+
+	r->map_sz = req.tp_block_size * req.tp_block_nr;
+	r->map = mmap(NULL, r->map_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, r->fd, 0);
+	if (r->map == MAP_FAILED)
+	  r->map = mmap(NULL, r->map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, r->fd, 0);
+	if (r->map == MAP_FAILED)
+	  {
+	    r->map = NULL;
+	    goto fail;
+	  }
+
+	memset(&sll, 0, sizeof(sll));
+	sll.sll_family = AF_PACKET;
+	sll.sll_protocol = htons(ETH_P_IP);
+	sll.sll_ifindex = if_nametoindex(ifname);
+	if (!sll.sll_ifindex || bind(r->fd, (struct sockaddr *) &sll, sizeof(sll)) == -1)
+	  goto fail;
+
+	event_assign(&r->event, base->event_base, r->fd, EV_READ | EV_PERSIST, ring_callback, base);
+	event_add(&r->event, NULL);
+
+	return r;
+
+fail:
+	ring_free(r);
+	return NULL;
+}
+
+
+/* Stop the raw socket from queueing what is now read from the ring */
+static void
+ring_mute_rawfd(struct evping_base *base)
+{
+	struct sock_filter code [] = { BPF_STMT(BPF_RET + BPF_K, 0) };
+	struct sock_fprog filter = { 1, code };
+
+	event_del(&base->event);
+	setsockopt(base->rawfd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter));
+}
+
+#endif /* EVPING_HAVE_PACKET_RING */
+
+
+/* Format an ICMP Echo Request for a given host and hand it to the transport in use */
+static int
+evping_send(struct evping_base *base, struct evhost *host)
+{
+	u_char packet [MAX_DATA_SIZE];
+
+#ifdef EVPING_HAVE_IO_URING
+	if (base->uring && !host->source)
+	  return uring_send(base, host);
+#endif
+
+	/* Format the ICMP Echo Request packet to send, only its own bytes are cleared */
+	memset(packet, 0, base->pktsize);
+	evhost_fmticmp(base, host, packet);
+
+	/* Nothing goes on the wire while simulating */
+	if (base->sim)
+	  return sim_transmit(base, host->source, &host->saddr, packet, base->pktsize);
+
+	/* Transmit the request over the network, from the socket of its source (if any) */
+	return sendto(host->source ? host->source->fd : base->rawfd, packet, base->pktsize, MSG_DONTWAIT,
+		      (struct sockaddr *) &host->saddr, sizeof(struct sockaddr_in));
+}
+
+
+/* Attempt to transmit an ICMP Echo Request to a given host */
+static void ping_callback(int unused, const short event, void *h)
+{
+	struct evhost *host = h;
+	struct evping_base *base = host->base;
+
+	int nsent;
+	struct timeval now;
+	struct timeval late;
+
+	/* Keep track of how late the ping is over its schedule */
+	evping_now(base, &now);
+	evutil_timersub(&now, &host->due, &late);
+	histogram_add(&base->lateness, tvtousecs(&late));
+
+	/* Clean the no reply timer (if any was previously set) */
+	evping_timer_del(base, &host->noreply_timer);
+
+	/* Format and transmit the request over the network */
+	nsent = evping_send(base, host);
+
+	if (nsent == base->pktsize)
+	  {
+	    /* One more ICMP Echo Request sent */
+	    base->sentok++;
+	    if (host->source)
+	      host->source->sentok++;
+
+	    if (!host->sentpkts && !base->quiet)
+	      printf("PING %s (%s) %d(%d) bytes of data.\n", host->fqname, host->ipname,
+		     base->pktsize - ICMP_MINLEN, nsent + IPHDR);
+
+	    /* Update timestamps and counters */
+	    if (!host->sentpkts)
+	      host->firstsent = now;
+	    host->lastsent = now;
+	    host->sentpkts++;
+	    host->sentbytes += nsent;
+	    if (host->group)
+	      host->group->sentpkts++;
+
+	    /* Add the timer to handle no reply condition in the given timeout */
+	    evping_timer_add(base, &host->noreply_timer, &base->tv_noreply);
+	  }
+	else
+	  {
+	    base->sendfail++;
+	    if (host->source)
+	      host->source->sendfail++;
+
+	    /* Handled as if no reply was received, so that the host is pinged again */
+	    evping_timer_add(base, &host->noreply_timer, &base->tv_noreply);
+	  }
+}
+
+
+/*
+ * Transmit an ICMP Echo Request to a target of the ranges, always via the raw socket and with the index
+ * in the payload (compact probes included), return 0 if successful or the error number in the event of error
+ * (EIO for partial transmissions and failures of the simulated responder, which do not set errno)
+ */
+static int
+range_send(struct evping_base *base, uint32_t slot)
+{
+	u_char packet [MAX_DATA_SIZE];
+	struct evtarget *target = &base->targets[slot];
+	struct sockaddr_in to;
+	struct timeval now;
+	int size = MAX(base->pktsize, (int) (ICMP_MINLEN + MIN_DATA_SIZE));  /* Always with a payload */
+	int nsent;
+
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_addr.s_addr = range_addr(base, slot);
+
+	memset(packet, 0, size);
+	evping_now(base, &now);
+	fmticmp(packet, size, base->sweepseq, RANGE_INDEX | slot, base->pid, &now);
+	if (base->sim)
+	  nsent = sim_transmit(base, NULL, &to, packet, size);
+	else if ((nsent = sendto(base->rawfd, packet, size, MSG_DONTWAIT, (struct sockaddr *) &to, sizeof(to))) == -1)
+	  return errno;
+	if (nsent != size)
+	  return EIO;
+
+	target->sent++;
+
+	/* The sequence wraps around, so one last credited 256 sweeps ago is no longer */
+	if (target->lastseq == base->sweepseq)
+	  target->lastseq = base->sweepseq - 1;
+	if (target->host >= 0)
+	  {
+	    struct evhost *host = base->hosts[target->host];
+	    host->lastsent = now;
+	    host->sentpkts++;
+	    host->sentbytes += nsent;
+	  }
+	return 0;
+}
+
+
+/* Keep track of the time the sweep took and schedule the next one at the given time interval from its beginning */
+static void
+sweep_done(struct evping_base *base)
+{
+	struct timeval now;
+	struct timeval next = { 0, 0 };
+
+	evping_now(base, &now);
+	evutil_timersub(&now, &base->sweepstart, &base->sweeptime);
+	if (evutil_timercmp(&base->sweeptime, &base->tv_interval, <))
+	  evutil_timersub(&base->tv_interval, &base->sweeptime, &next);
+
+	base->sweeps++;
+	base->cursor = 0;
+	base->sweepseq++;
+	base->sweepreplies = 0;
+
+	if (base->remaining && !--base->remaining)
+	  evping_finished(base);
+	else
+	  evping_timer_add(base, &base->sweep, &next);
+}
+
+
+/*
+ * Send the next batch of requests of a sweep of the ranges.
+ *
+ * Batches are sent from timers rather than all at once so that replies are read in between.
+ * Once all the targets have been sent, the sweep is complete when either all of them
+ * have replied or the timeout has elapsed since the last one.
+ */
+static void sweep_callback(int unused, const short event, void *arg)
+{
+	struct evping_base *base = arg;
+	struct timeval asap = { 0, 0 };
+	struct timeval retry;
+	unsigned n;
+	int err;
+
+	EVPING_LOCK(base);
+
+	if (base->cursor == base->ntargets)
+	  {
+	    sweep_done(base);
+	    goto done;
+	  }
+
+	if (!base->cursor)
+	  evping_now(base, &base->sweepstart);
+
+	for (n = 0; n < RANGE_BATCH && base->cursor < base->ntargets; n++)
+	  {
+	    if (!(err = range_send(base, base->cursor)))
+	      base->sentok++;
+	    else
+	      {
+		base->sendfail++;
+		if (err == EAGAIN || err == EWOULDBLOCK || err == ENOBUFS)
+		  {
+		    /* Try the same target again when there is room in the send buffer */
+		    msecstotv(RANGE_RETRY, &retry);
+		    evping_timer_add(base, &base->sweep, &retry);
+		    goto done;
+		  }
+	      }
+	    base->cursor++;
+	  }
+
+	evping_timer_add(base, &base->sweep, base->cursor < base->ntargets ? &asap : &base->tv_noreply);
+done:
+	EVPING_UNLOCK(base);
+}
+
+
+/*
+ * Read the packets queued on a raw socket ('source', NULL for the default one) and pass them
+ * to evping_reply() for decoding, along with the time the kernel has received them.  A packet
+ * is read at each call, unless ranges are swept (they are sent in batches) or sources are in use
+ * (each socket also gets the copies of the replies to the others): then up to four batches of
+ * packets are read if they are queued.
+ */
+static void
+evping_drain(struct evping_base *base, struct evping_source *source, evutil_socket_t fd)
+{
+	int nrecv;
+	u_char packet[MAX_DATA_SIZE];
+	struct sockaddr_in remote;                  /* responding internet address */
+	u_char control[CMSG_SPACE(sizeof(struct timeval)) + CMSG_SPACE(sizeof(uint32_t))];
+	struct iovec iov = { packet, sizeof(packet) };
+	struct msghdr msg = { &remote, sizeof(remote), &iov, 1, control, sizeof(control), 0 };
+	unsigned n = 0;
+
+	struct timeval ts;
+
+	ASSERT_LOCKED(base);
+
+	do {
+		/* Receive data from the network */
+		msg.msg_controllen = sizeof(control);
+		nrecv = recvmsg(fd, &msg, MSG_DONTWAIT);
+		if (nrecv < 0)
+		  {
+		    /* One more failure, unless the queue has been drained */
+		    if (!n)
+		      base->recvfail++;
+		    break;
+		  }
+		if (source)
+		  source->recvok++;
+
+		/* Time the packet has been received (by the kernel if known) */
+		gettimeofday(&ts, NULL);
+		evping_ancillary(source ? &source->kdrops : &base->kdrops, &msg, &ts);
+
+		evping_received(base, source, packet, nrecv, &ts);
+	} while ((base->ntargets || base->nsources) && ++n < 4 * RANGE_BATCH);
+}
+
+
+/* Called by libevent when the kernel says that the default raw socket is ready for reading */
+static void ready_callback (int unused, const short event, void * arg)
+{
+	struct evping_base *base = arg;
+
+	EVPING_LOCK(base);
+
+	evping_drain(base, NULL, base->rawfd);
+	evping_sample_queue(base);
+
+	EVPING_UNLOCK(base);
+}
+
+
+/* Called by libevent when the kernel says that the raw socket of a source is ready for reading */
+static void source_callback(int unused, const short event, void *arg)
+{
+	struct evping_source *source = arg;
+	struct evping_base *base = source->base;
+
+	EVPING_LOCK(base);
+	evping_drain(base, source, source->fd);
+	EVPING_UNLOCK(base);
+}
+
+
+/* Notify the user that all the hosts are done with their probes */
+static void done_callback(int unused, const short event, void *arg)
+{
+	struct evping_base *base = arg;
+	evping_done_callback_type callback;
+	void *ptr;
+
+	EVPING_LOCK(base);
+	callback = base->done_callback;
+	ptr = base->done_pointer;
+	EVPING_UNLOCK(base);
+
+	if (callback)
+	  callback(base, ptr);
+}
+
+
+/* Create the shared memory segment with a slot for each host, or return NULL in the event of error */
+static struct evping_shm_header *
+shm_new(struct evping_base *base, size_t *size)
+{
+	struct evping_shm_header *hdr;
+	struct evhost *host;
+	size_t hdr_size = (sizeof(struct evping_shm_header) + 63) & ~63;
+	size_t slot_size = (sizeof(struct evping_shm_slot) + base->shmsamples * sizeof(struct evping_shm_sample) + 63) & ~63;
+	int fd;
+
+	*size = hdr_size + base->argc * slot_size;
+
+	/* Readable by everyone */
+	fd = shm_open(base->shmname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+	  return NULL;
+	if (ftruncate(fd, *size) == -1)
+	  {
+	    close(fd);
+	    shm_unlink(base->shmname);
+	    return NULL;
+	  }
+	hdr = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (hdr == MAP_FAILED)
+	  {
+	    shm_unlink(base->shmname);
+	    return NULL;
+	  }
+
+	hdr->version   = EVPING_SHM_VERSION;
+	hdr->hdr_size  = hdr_size;
+	hdr->slot_size = slot_size;
+	hdr->slots     = base->argc;
+	hdr->samples   = base->shmsamples;
+	hdr->pid       = base->pid;
+	hdr->interval  = tvtousecs(&base->tv_interval) / 1000;
+	hdr->started   = time(NULL);
+
+	host = base->host_head;
+	if (host)
+	  do {
+		  struct evping_shm_slot *slot = EVPING_SHM_SLOT(hdr, host->index);
+		  slot->addr = host->saddr.sin_addr.s_addr;
+		  strncpy(slot->name, host->fqname, sizeof(slot->name) - 1);
+		  host = host->next;
+	  } while (host != base->host_head);
+
+	/* Tell the readers the segment is ready */
+	__atomic_store_n(&hdr->magic, EVPING_SHM_MAGIC, __ATOMIC_RELEASE);
+
+	return hdr;
+}
+
+
+/* Unmap and remove the shared memory segment (readers keep their mappings) */
+static void
+shm_free(struct evping_base *base)
+{
+	munmap(base->shm, base->shm_sz);
+	shm_unlink(base->shmname);
+	base->shm = NULL;
+}
+
+
+/* Set the size of a socket buffer, beyond the system wide limit when permitted */
+static void
+evping_sockbuf(evutil_socket_t fd, int force, int option, int size)
+{
+	int current;
+	socklen_t len = sizeof(current);
+
+	/* Sizes set automatically never shrink the buffers (the kernel doubles the value to account for its overhead) */
+	if (!force && getsockopt(fd, SOL_SOCKET, option, &current, &len) == 0 && current >= 2 * size)
+	  return;
+
+#if defined(SO_RCVBUFFORCE) && defined(SO_SNDBUFFORCE)
+	if (setsockopt(fd, SOL_SOCKET, option == SO_RCVBUF ? SO_RCVBUFFORCE : SO_SNDBUFFORCE, &size, sizeof(size)) == 0)
+	  return;
+#endif
+	setsockopt(fd, SOL_SOCKET, option, &size, sizeof(size));
+}
+
+
+/*
+ * Size the socket buffers unless the user did.
+ *
+ * Each host has at most one request in flight whatever the interval is, and all of
+ * them are sent at once at the start, so the worst burst to be held is a request or
+ * a reply per host.  Room for two packets per host is given anyway since the raw
+ * socket also receives the requests looped back when pinging local addresses.
+ */
+static void
+evping_size_buffers(struct evping_base *base)
+{
+	double burst = ((double) base->argc + base->ntargets) * 2 * (base->pktsize + IPHDR + SKB_OVERHEAD);
+	int size = MIN(burst, MAX_SOCKBUF);
+
+	unsigned i;
+
+	evping_sockbuf(base->rawfd, base->rcvbuf != 0, SO_RCVBUF, base->rcvbuf ? base->rcvbuf : size);
+	evping_sockbuf(base->rawfd, base->sndbuf != 0, SO_SNDBUF, base->sndbuf ? base->sndbuf : size);
+
+	/* The sockets of the sources for their own hosts */
+	for (i = 0; i < base->nsources; i++)
+	  {
+	    struct evping_source *source = base->sources[i];
+	    burst = (double) source->hosts * 2 * (base->pktsize + IPHDR + SKB_OVERHEAD);
+	    size = MIN(burst, MAX_SOCKBUF);
+	    evping_sockbuf(source->fd, base->rcvbuf != 0, SO_RCVBUF, base->rcvbuf ? base->rcvbuf : size);
+	    evping_sockbuf(source->fd, base->sndbuf != 0, SO_SNDBUF, base->sndbuf ? base->sndbuf : size);
+	  }
+}
+
+
+/* Allocate a descriptor for an already resolved host and add it to those to be pinged */
+static struct evhost *
+evhost_new(struct evping_base *base, const char *name, struct in_addr addr, const char *fqname)
+{
+	struct evhost *host;
+
+	ASSERT_LOCKED(base);
+
+	/* The slot of the host must fit in compact probes */
+	if (base->compact && base->argc == COMPACT_MAX_HOSTS) return NULL;
+
+	/* Make room in the table of hosts */
+	if (base->argc == base->hosts_sz) {
+		unsigned n = base->hosts_sz ? 2 * base->hosts_sz : 16;
+		struct evhost **hosts = mm_realloc(base->hosts, n * sizeof(struct evhost *));
+		if (!hosts) return NULL;
+		base->hosts = hosts;
+		base->hosts_sz = n;
+	}
+
+	host = (struct evhost *) mm_malloc(sizeof(struct evhost));
+	if (!host) return NULL;
+
+	memset(host, 0, sizeof(struct evhost));
+
+	host->base = base;
+	host->name = mm_strdup(name);
+	host->saddr.sin_family = AF_INET;
+	host->saddr.sin_addr = addr;
+	host->fqname = mm_strdup(fqname);
+	host->ipname = mm_strdup(inet_ntoa(addr));
+
+	host->index = base->argc;
+	host->seq = 1;
+	host->shortest = MAXINT;
+
+	/* Define here the callbacks to ping the host and to handle no reply timeouts */
+	evping_timer_assign(base, &host->ping_timer, ping_callback, host);
+	evping_timer_assign(base, &host->noreply_timer, noreply_callback, host);
+
+	/* insert this host into the list of them */
+	if (!base->host_head) {
+	  host->next = host->prev = host;
+	  base->host_head = host;
+	} else {
+	  host->next = base->host_head->next;
+	  host->prev = base->host_head;
+	  base->host_head->next = host;
+	  if (base->host_head->prev == base->host_head) {
+	    base->host_head->prev = host;
+	  }
+	}
+
+	base->hosts[base->argc++] = host;
+
+	return host;
+}
+
+
+/* Create a non-blocking raw socket for ICMP, or return -1 in the event of error */
+static evutil_socket_t
+evping_socket(void)
+{
+	struct protoent *proto;
+	evutil_socket_t fd;
+	int one = 1;
+
+	/* Check if the ICMP protocol is available on this system */
+	if (!(proto = getprotobyname("icmp"))) {
+	  return -1;
+	}
+
+	/* Create an endpoint for communication using raw socket for ICMP calls */
+	if ((fd = socket(AF_INET, SOCK_RAW, proto->p_proto)) == -1) {
+	  return -1;
+	}
+	evutil_make_socket_nonblocking(fd);
+
+	/* Ask the kernel for the time each packet is received and for the count of packets it drops */
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMP, &one, sizeof(one));
+#ifdef SO_RXQ_OVFL
+	setsockopt(fd, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one));
+#endif
+
+	return fd;
+}
+
+
+/* exported function */
+struct evping_base *
+evping_base_new(struct event_base *event_base)
+{
+	return evping_base_new_with_flags(event_base, 0);
+}
+
+
+/* exported function */
+struct evping_base *
+evping_base_new_with_flags(struct event_base *event_base, int flags)
+{
+	evutil_socket_t fd = -1;
+	struct evping_base *base;
+
+	if (!(flags & EVPING_BASE_NO_SOCKET) && (fd = evping_socket()) == -1) {
+	  return NULL;
+	}
+
+	base = mm_malloc(sizeof(struct evping_base));
+	if (base == NULL)
+		return (NULL);
+	memset(base, 0, sizeof(struct evping_base));
+
+	EVTHREAD_ALLOC_LOCK(base->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	EVPING_LOCK(base);
+
+	base->event_base = event_base;
+
+	base->rawfd = fd;
+
+	/* Set default values */
+	base->pktsize = DEFAULT_PKT_SIZE;
+	base->pid = getpid();
+
+	msecstotv(DEFAULT_NOREPLY_TIMEOUT, &base->tv_noreply);
+	msecstotv(DEFAULT_PING_INTERVAL, &base->tv_interval);
+	base->shmsamples = DEFAULT_SHM_SAMPLES;
+
+	/* Define the callback to handle ICMP Echo Reply and add the raw file descriptor to those monitored for read events */
+	event_assign(&base->event, base->event_base, base->rawfd, EV_READ | EV_PERSIST, ready_callback, base);
+	if (base->rawfd != -1)
+	  event_add(&base->event, NULL);
+
+	evping_timer_assign(base, &base->sweep, sweep_callback, base);
+	evping_timer_assign(base, &base->done, done_callback, base);
+
+	EVPING_UNLOCK(base);
+	return base;
+}
+
+
+/* exported function */
+void
+evping_base_free(struct evping_base *base, int fail_requests)
+{
+	EVPING_LOCK(base);
+
+#ifdef EVPING_HAVE_IO_URING
+	if (base->uring)
+	  uring_free(base->uring);
+	base->uring = NULL;
+#endif
+
+#ifdef EVPING_HAVE_PACKET_RING
+	if (base->ring)
+	  ring_free(base->ring);
+	base->ring = NULL;
+#endif
+	mm_free(base->ringif);
+
+	if (base->shm)
+	  shm_free(base);
+	mm_free(base->shmname);
+
+	/* Release the hosts, pending requests are silently discarded */
+	while (base->argc) {
+		struct evhost *host = base->hosts[--base->argc];
+		evping_timer_del(base, &host->ping_timer);
+		evping_timer_del(base, &host->noreply_timer);
+		mm_free(host->name);
+		mm_free(host->fqname);
+		mm_free(host->ipname);
+		mm_free(host);
+	}
+	mm_free(base->hosts);
+	base->host_head = NULL;
+
+	while (base->ngroups) {
+		struct evgroup *group = base->groups[--base->ngroups];
+		mm_free(group->name);
+		mm_free(group);
+	}
+	mm_free(base->groups);
+
+	while (base->nsources) {
+		struct evping_source *source = base->sources[--base->nsources];
+		event_del(&source->event);
+		close(source->fd);
+		mm_free(source->name);
+		mm_free(source);
+	}
+	mm_free(base->sources);
+
+	evping_timer_del(base, &base->sweep);
+	evping_timer_del(base, &base->done);
+
+	if (base->pcap)
+	  writer_free(base->pcap);
+	if (base->log)
+	  log_free(base->log);
+	if (base->replay)
+	  replay_free(base, base->replay);
+	if (base->sim)
+	  sim_free(base->sim);
+	mm_free(base->ranges);
+	mm_free(base->targets);
+
+	if (base->rawfd != -1)
+	  {
+	    event_del(&base->event);
+	    close(base->rawfd);
+	  }
+
+	EVPING_UNLOCK(base);
+	EVTHREAD_FREE_LOCK(base->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+
+	mm_free(base);
+}
+
+
+/* exported function */
+int
+evping_base_set_option(struct evping_base *base, const char *option, const char *val)
+{
+	int res = 0;
+	unsigned i;
+	int n;
+
+	EVPING_LOCK(base);
+	n = strtoint(val);
+	if (str_matches_option(option, "interval:")) {
+		if (n < 0) goto fail;
+		msecstotv(n, &base->tv_interval);
+	} else if (str_matches_option(option, "timeout:")) {
+		if (n <= 0) goto fail;
+		msecstotv(n, &base->tv_noreply);
+	} else if (str_matches_option(option, "size:")) {
+		if (n < (base->compact ? 0 : (int) MIN_DATA_SIZE) || n > (int) MAX_DATA_SIZE) goto fail;
+#ifdef EVPING_HAVE_IO_URING
+		/* The buffers of the io_uring transport are already sized */
+		if (base->uring) goto fail;
+#endif
+		base->pktsize = ICMP_MINLEN + n;
+		base->sized = 1;
+	} else if (str_matches_option(option, "compact:")) {
+		if (n < 0 || (n && base->argc > COMPACT_MAX_HOSTS)) goto fail;
+#ifdef EVPING_HAVE_IO_URING
+		if (base->uring) goto fail;
+#endif
+#ifdef EVPING_HAVE_PACKET_RING
+		/* The filter of the packet ring only takes the identifiers of the probes it was created for */
+		if (base->ring && base->compact != (n != 0)) goto fail;
+#endif
+		base->compact = n != 0;
+		/* The size given by the user is kept, unless too small for the probes with a payload */
+		if (base->compact && !base->sized)
+		  base->pktsize = ICMP_MINLEN;
+		else if (!base->compact && base->pktsize < (int) (ICMP_MINLEN + MIN_DATA_SIZE))
+		  base->pktsize = base->sized ? (int) (ICMP_MINLEN + MIN_DATA_SIZE) : DEFAULT_PKT_SIZE;
+	} else if (str_matches_option(option, "quiet:")) {
+		if (n < 0) goto fail;
+		base->quiet = n != 0;
+	} else if (str_matches_option(option, "io-uring:")) {
+		if (n < 0) goto fail;
+		base->use_uring = n != 0;
+	} else if (str_matches_option(option, "so-rcvbuf:")) {
+		if (n < 0) goto fail;
+		base->rcvbuf = n;
+	} else if (str_matches_option(option, "so-sndbuf:")) {
+		if (n < 0) goto fail;
+		base->sndbuf = n;
+	} else if (str_matches_option(option, "shm:")) {
+		if (*val != '/' || base->shm) goto fail;
+		mm_free(base->shmname);
+		base->shmname = mm_strdup(val);
+	} else if (str_matches_option(option, "backoff:")) {
+		if (n < 0) goto fail;
+		msecstotv(n, &base->tv_backoff);
+	} else if (str_matches_option(option, "log:")) {
+		if (!*val || base->log) goto fail;
+		if (!(base->log = log_new(val, base->logrecords ? base->logrecords : DEFAULT_LOG_RECORDS, base->logsegments))) goto fail;
+	} else if (str_matches_option(option, "log-records:")) {
+		if (n <= 0 || base->log) goto fail;
+		base->logrecords = n;
+	} else if (str_matches_option(option, "log-segments:")) {
+		if (n < 0 || base->log) goto fail;
+		base->logsegments = n;
+	} else if (str_matches_option(option, "pcap:")) {
+		if (!*val || base->pcap) goto fail;
+		if (!(base->pcap = pcap_new(val))) goto fail;
+	} else if (str_matches_option(option, "shm-samples:")) {
+		if (n <= 0 || base->shm) goto fail;
+		base->shmsamples = n;
+	} else if (str_matches_option(option, "simulate:")) {
+		/* All the timers must be dispatched by the same clock */
+		if (n <= 0 || base->sim || base->prepared || base->replay || evping_timer_pending(&base->sweep)) goto fail;
+		if (!(base->sim = sim_new())) goto fail;
+		/* Nothing is read from the sockets while simulating */
+		if (base->rawfd != -1)
+		  event_del(&base->event);
+		for (i = 0; i < base->nsources; i++)
+		  event_del(&base->sources[i]->event);
+	} else if (str_matches_option(option, "sim-rtt:")) {
+		if (n < 0 || !base->sim) goto fail;
+		base->sim->rtt = n;
+	} else if (str_matches_option(option, "sim-jitter:")) {
+		if (n < 0 || !base->sim) goto fail;
+		base->sim->jitter = n;
+	} else if (str_matches_option(option, "sim-loss:")) {
+		if (n < 0 || n > 100 || !base->sim) goto fail;
+		base->sim->loss = n;
+	} else if (str_matches_option(option, "sim-dead:")) {
+		if (n < 0 || n > 100 || !base->sim) goto fail;
+		base->sim->dead = n;
+	} else if (str_matches_option(option, "sim-seed:")) {
+		if (n < 0 || !base->sim) goto fail;
+		base->sim->seed = 0x9e3779b97f4a7c15ULL ^ n;
+	} else if (str_matches_option(option, "packet-ring:")) {
+#ifdef EVPING_HAVE_PACKET_RING
+		if (!*val || base->ring) goto fail;
+		mm_free(base->ringif);
+		base->ringif = mm_strdup(val);
+#else
+		goto fail;
+#endif
+	} else
+		goto fail;
+	goto done;
+fail:
+	res = -1;
+done:
+	EVPING_UNLOCK(base);
+	return res;
+}
+
+
+/* exported function */
+int
+evping_base_group_add(struct evping_base *base, const char *name)
+{
+	struct evgroup *group;
+	unsigned i;
+	int res = -1;
+
+	EVPING_LOCK(base);
+
+	/* A group is only added once */
+	for (i = 0; i < base->ngroups; i++)
+	  if (!strcmp(base->groups[i]->name, name))
+	    {
+	      res = i;
+	      goto done;
+	    }
+
+	/* Make room in the table of groups */
+	if (base->ngroups == base->groups_sz) {
+		unsigned n = base->groups_sz ? 2 * base->groups_sz : 8;
+		struct evgroup **groups = mm_realloc(base->groups, n * sizeof(struct evgroup *));
+		if (!groups) goto done;
+		base->groups = groups;
+		base->groups_sz = n;
+	}
+
+	group = mm_calloc(1, sizeof(struct evgroup));
+	if (!group) goto done;
+	group->name = mm_strdup(name);
+	if (!group->name) {
+		mm_free(group);
+		goto done;
+	}
+	group->shortest = MAXINT;
+
+	res = base->ngroups;
+	base->groups[base->ngroups++] = group;
+done:
+	EVPING_UNLOCK(base);
+	return res;
+}
+
+
+/* exported function */
+int
+evping_base_source_add(struct evping_base *base, const char *name)
+{
+	struct evping_source *source;
+	struct sockaddr_in sin;
+	evutil_socket_t fd;
+	int res = -1;
+
+	if ((fd = evping_socket()) == -1)
+	  return -1;
+
+	/* Bound to a source address, or else to an interface */
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	if (inet_pton(AF_INET, name, &sin.sin_addr) == 1) {
+		if (bind(fd, (struct sockaddr *) &sin, sizeof(sin)) == -1) goto fail;
+	} else {
+#ifdef SO_BINDTODEVICE
+		if (setsockopt(fd, SOL_SOCKET, SO_BINDTODEVICE, name, strlen(name) + 1) == -1) goto fail;
+#else
+		goto fail;
+#endif
+	}
+
+	EVPING_LOCK(base);
+
+	/* Make room in the table of sources */
+	if (base->nsources == base->sources_sz) {
+		unsigned n = base->sources_sz ? 2 * base->sources_sz : 4;
+		struct evping_source **sources = mm_realloc(base->sources, n * sizeof(struct evping_source *));
+		if (!sources) goto done;
+		base->sources = sources;
+		base->sources_sz = n;
+	}
+
+	source = mm_calloc(1, sizeof(struct evping_source));
+	if (!source) goto done;
+	source->name = mm_strdup(name);
+	if (!source->name) {
+		mm_free(source);
+		goto done;
+	}
+	source->base = base;
+	source->fd = fd;
+
+	/* Each source reads its own replies, unless they are simulated */
+	event_assign(&source->event, base->event_base, fd, EV_READ | EV_PERSIST, source_callback, source);
+	if (!base->sim)
+	  event_add(&source->event, NULL);
+
+	res = base->nsources;
+	base->sources[base->nsources++] = source;
+done:
+	EVPING_UNLOCK(base);
+	if (res != -1)
+	  return res;
+fail:
+	close(fd);
+	return -1;
+}
+
+
+/* Release the host added last, which has not been probed yet */
+static void
+evhost_free_last(struct evping_base *base)
+{
+	struct evhost *host = base->hosts[--base->argc];
+
+	ASSERT_LOCKED(base);
+
+	/* Hosts are inserted next to the head of the list, unless they are the first */
+	if (host == base->host_head)
+	  base->host_head = NULL;
+	else
+	  {
+	    base->host_head->next = host->next;
+	    if (base->host_head->prev == host)
+	      base->host_head->prev = base->host_head;
+	  }
+
+	if (host->group)
+	  host->group->hosts--;
+	if (host->source)
+	  host->source->hosts--;
+
+	mm_free(host->name);
+	mm_free(host->fqname);
+	mm_free(host->ipname);
+	mm_free(host);
+}
+
+
+/* exported function */
+int
+evping_host_add(struct evping_base *base, char * name, int group, int source)
+{
+	struct hostent *h;
+	struct in_addr addr;
+	struct evhost *host = NULL;
+	unsigned n;
+	unsigned i;
+	int known;
+
+	/* The group and the source must be known */
+	EVPING_LOCK(base);
+	known = group >= -1 && (group < 0 || (unsigned) group < base->ngroups) &&
+		(source == -1 || (source == EVPING_SOURCE_ALL && base->nsources) ||
+		 (source >= 0 && (unsigned) source < base->nsources));
+	EVPING_UNLOCK(base);
+	if (!known) return -1;
+
+	/* Attempt to resolv 'name' */
+	h = gethostbyname(name);
+	if (!h && inet_addr(name) == INADDR_NONE) return -1;
+
+	if (h)
+	  memcpy (&addr, h->h_addr_list[0], h->h_length);
+	else
+	  addr.s_addr = inet_addr(name);
+
+	/* Back to the full qualified domain address */
+	h = gethostbyaddr((char *) &addr, sizeof(struct in_addr), AF_INET);
+
+	EVPING_LOCK(base);
+	n = source == EVPING_SOURCE_ALL ? base->nsources : 1;
+	for (i = 0; i < n; i++)
+	  {
+	    host = evhost_new(base, name, addr, !h || !h->h_name ? name : h->h_name);
+	    if (!host)
+	      {
+		/* All or none, those already added for the other sources are taken back */
+		while (i--)
+		  evhost_free_last(base);
+		break;
+	      }
+	    if (group >= 0)
+	      {
+		host->group = base->groups[group];
+		host->group->hosts++;
+	      }
+	    if (source != -1)
+	      {
+		host->source = base->sources[source == EVPING_SOURCE_ALL ? i : (unsigned) source];
+		host->source->hosts++;
+	      }
+	  }
+	EVPING_UNLOCK(base);
+
+	return host ? 0 : -1;
+}
+
+
+/* exported function */
+int
+evping_base_host_add(struct evping_base *base, char * name)
+{
+	return evping_host_add(base, name, -1, -1);
+}
+
+
+/* exported function */
+int
+evping_base_range_add(struct evping_base *base, const char *prefix)
+{
+	char buf[INET_ADDRSTRLEN];
+	const char *slash = strchr(prefix, '/');
+	struct in_addr net;
+	struct evrange *ranges;
+	struct evtarget *targets;
+	uint32_t first;
+	uint32_t count;
+	uint32_t i;
+	int bits = 32;
+
+	/* A bare address is a /32 */
+	if (slash) {
+		if ((size_t) (slash - prefix) >= sizeof(buf)) return -1;
+		memcpy(buf, prefix, slash - prefix);
+		buf[slash - prefix] = '\0';
+		bits = strtoint(slash + 1);
+		if (bits < RANGE_MIN_PREFIX || bits > 32) return -1;
+	} else {
+		if (strlen(prefix) >= sizeof(buf)) return -1;
+		strcpy(buf, prefix);
+	}
+	if (inet_pton(AF_INET, buf, &net) != 1) return -1;
+
+	first = ntohl(net.s_addr) & (bits ? ~0U << (32 - bits) : 0);
+	count = bits == 32 ? 1 : 1U << (32 - bits);
+
+	/* The network and the broadcast addresses are not swept, except for /31 and /32 */
+	if (bits < 31) {
+		first++;
+		count -= 2;
+	}
+
+	EVPING_LOCK(base);
+
+	ranges = mm_realloc(base->ranges, (base->nranges + 1) * sizeof(struct evrange));
+	if (!ranges) goto fail;
+	base->ranges = ranges;
+
+	targets = mm_realloc(base->targets, ((size_t) base->ntargets + count) * sizeof(struct evtarget));
+	if (!targets) goto fail;
+	base->targets = targets;
+
+	for (i = 0; i < count; i++) {
+		targets[base->ntargets + i].sent = 0;
+		targets[base->ntargets + i].host = -1;
+		targets[base->ntargets + i].lastseq = 0;
+	}
+
+	ranges[base->nranges].addr = first;
+	ranges[base->nranges].first = base->ntargets;
+	ranges[base->nranges].count = count;
+	base->nranges++;
+	base->ntargets += count;
+	base->rangemem += sizeof(struct evrange) + count * sizeof(struct evtarget);
+
+	EVPING_UNLOCK(base);
+	return 0;
+fail:
+	EVPING_UNLOCK(base);
+	return -1;
+}
+
+
+/*
+ * Stop reading the default socket while all the hosts are probed from sources of their own, since it
+ * gets a copy of all their replies, and read it again as soon as any host or range is probed from it
+ */
+static void
+evping_mute_default(struct evping_base *base)
+{
+	unsigned others = 0;
+	unsigned i;
+	u_char mute;
+
+	if (base->sim || base->rawfd == -1)
+	  return;
+#ifdef EVPING_HAVE_PACKET_RING
+	if (base->ring)
+	  return;
+#endif
+#ifdef EVPING_HAVE_IO_URING
+	if (base->uring)
+	  return;
+#endif
+
+	for (i = 0; i < base->nsources; i++)
+	  others += base->sources[i]->hosts;
+	mute = base->nsources && others == base->argc && !base->ntargets;
+	if (mute == base->muted)
+	  return;
+
+	if (mute)
+	  {
+	    event_del(&base->event);
+#if defined(SO_ATTACH_FILTER) && defined(BPF_STMT)
+	    {
+	      struct sock_filter code [] = { BPF_STMT(BPF_RET + BPF_K, 0) };
+	      struct sock_fprog filter = { 1, code };
+	      setsockopt(base->rawfd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter));
+	    }
+#endif
+	  }
+	else
+	  {
+#if defined(SO_DETACH_FILTER) && defined(BPF_STMT)
+	    setsockopt(base->rawfd, SOL_SOCKET, SO_DETACH_FILTER, NULL, 0);
+#endif
+	    event_add(&base->event, NULL);
+	  }
+	base->muted = mute;
+}
+
+
+/* Get the transport ready to ping the hosts added so far */
+static void
+evping_prepare(struct evping_base *base)
+{
+	ASSERT_LOCKED(base);
+
+	evping_size_buffers(base);
+	base->prepared = base->argc;
 
-	/* The ICMP portion */
-	icmp = (struct icmphdr *) (packet + hlen);
+	/* Create the shared memory segment to publish the samples to (if requested) */
+	if (base->shmname && !base->shm)
+	  base->shm = shm_new(base, &base->shm_sz);
 
-	/* Check the ICMP header to drop unexpected packets due to unrecognized id */
-	if (icmp->un.echo.id != base->pid)
-	  {
-	    /* One more foreign packet */
-	    base->foreign++;
+#ifdef EVPING_HAVE_PACKET_RING
+	/* Switch to the packet ring to receive the replies (if requested, not simulating and with the raw socket) */
+	if (base->ringif && !base->ring && !base->sim && base->rawfd != -1 && (base->ring = ring_new(base, base->ringif)))
+	  ring_mute_rawfd(base);
+#endif
 
-	    goto done;
+#ifdef EVPING_HAVE_IO_URING
+	/* Switch to the io_uring transport (if requested, supported by the running kernel, not simulating and with the raw socket) */
+	if (base->use_uring && !base->uring && !base->sim && base->rawfd != -1 && (base->uring = uring_new(base)))
+	  {
+	    event_del(&base->event);
+#ifdef EVPING_HAVE_PACKET_RING
+	    if (!base->ring)
+#endif
+	      uring_recv(base);
 	  }
+#endif
 
-	/* Check the ICMP payload for legal values of the 'index' portion */
-	if (base->argc < data->index)
-	  {
-	    /* One more illegal packet */
-	    base->illegal++;
+	if (base->nsources)
+	  evping_mute_default(base);
+}
 
-	    goto done;
-	  }
 
-	/* Get the pointer to the host descriptor in our internal table */
-	host = evping_lookup_host(base, data->index);
+/* Start pinging all the hosts and sweeping the ranges, 'count' times each (0 = forever) */
+static void
+evping_start(struct evping_base *base, int count, evping_callback_type callback,
+	     evping_done_callback_type done, void *ptr)
+{
+	struct timeval asap = { 0, 0 };
+	struct evhost *host;
 
-	/* Check for Destination Host Unreachable */
-	if (icmp->type == ICMP_ECHOREPLY)
-	  {
-	    /* Use the User Data to relate Echo Request/Reply and evaluate the Round Trip Time */
-	    struct timeval elapsed;             /* response time */
-	    time_t usecs;
+	EVPING_LOCK(base);
 
-	    /* Compute time difference to calculate the round trip */
-	    evutil_timersub (&now, &data->ts, &elapsed);
-
-	    /* Update timestamps */
-	    if (!host->recvpkts)
-	      gettimeofday (&host->firstrecv, NULL);
-	    gettimeofday (&host->lastrecv, NULL);
-	    host->recvpkts++;
-	    host->recvbytes += nrecv;
-
-	    /* Update counters */
-	    usecs = tvtousecs(&elapsed);
-	    host->shortest = MIN(host->shortest, usecs);
-	    host->longest = MAX(host->longest, usecs);
-	    host->sum += usecs;
-	    host->square += (usecs * usecs);
-
-	    if (host->user_callback)
-	      host->user_callback(PING_ERR_NONE, nrecv - IPHDR, host->fqname, host->ipname,
-				  ntohs(icmp->un.echo.sequence), ip->ip_ttl, &elapsed, host->user_pointer);
+	evping_prepare(base);
 
-	    /* Update the sequence number for the next run */
-	    host->seq = (host->seq + 1) % 256;
+	base->pending = 0;
+	base->done_callback = done;
+	base->done_pointer = ptr;
 
-	    /* Clean the noreply timer */
-	    evtimer_del(&host->noreply_timer);
+	host = base->host_head;
+	if (!host)
+		goto done;
+	do {
+		host->user_callback = callback;
+		host->user_pointer = ptr;
+		host->oneshot = 0;
 
-	    /* Add the timer to ping again the host at the given time interval */
-	    evtimer_add(&host->ping_timer, &host->base->tv_interval);
-	  }
-	else
-	  /* Handle this condition exactly as the request has expired */
-	  noreply_callback (-1, -1, host);
+		/* Schedule to immediately ping this host, unless it is swept */
+		if (!host->range)
+		  {
+		    host->remaining = count;
+		    base->pending++;
+		    evhost_schedule(host, &asap);
+		  }
 
+		host = host->next;
+	} while (host != base->host_head);
 done:
+	/* Start sweeping the ranges */
+	base->user_callback = callback;
+	base->user_pointer = ptr;
+	base->remaining = count;
+	if (base->ntargets)
+	  {
+	    base->pending++;
+	    if (!evping_timer_pending(&base->sweep))
+	      {
+		base->cursor = 0;
+		evping_timer_add(base, &base->sweep, &asap);
+	      }
+	  }
+
+	/* Nothing to do at all */
+	if (count && !base->pending)
+	  evping_timer_add(base, &base->done, &asap);
+
 	EVPING_UNLOCK(base);
 }
 
 
 /* exported function */
-struct evping_base *
-evping_base_new(struct event_base *event_base)
+void
+evping_ping(struct evping_base *base, evping_callback_type callback, void *ptr)
 {
-	struct protoent *proto;
-	evutil_socket_t fd;
-	struct evping_base *base;
-
-	/* Check if the ICMP protocol is available on this system */
-	if (!(proto = getprotobyname("icmp"))) {
-	  return NULL;
-	}
-
-	/* Create an endpoint for communication using raw socket for ICMP calls */
-	if ((fd = socket(AF_INET, SOCK_RAW, proto->p_proto)) == -1) {
-	  return NULL;
-	}
+	evping_start(base, 0, callback, NULL, ptr);
+}
 
-	base = mm_malloc(sizeof(struct evping_base));
-	if (base == NULL)
-		return (NULL);
-	memset(base, 0, sizeof(struct evping_base));
 
-	EVTHREAD_ALLOC_LOCK(base->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
-	EVPING_LOCK(base);
+/* exported function */
+void
+evping_sweep(struct evping_base *base, int count, evping_callback_type callback,
+	     evping_done_callback_type done, void *ptr)
+{
+	evping_start(base, count > 0 ? count : 1, callback, done, ptr);
+}
 
-	base->event_base = event_base;
 
-	base->rawfd = fd;
-	evutil_make_socket_nonblocking(base->rawfd);
+/* exported function */
+int
+evping_base_replay(struct evping_base *base, const char *filename, int paced,
+		   evping_callback_type callback, evping_done_callback_type done, void *ptr)
+{
+	struct timeval asap = { 0, 0 };
+	struct evhost *host;
+	int res = -1;
 
-	/* Set default values */
-	base->pktsize = DEFAULT_PKT_SIZE;
-	base->pid = getpid();
+	EVPING_LOCK(base);
+	if (base->replay || !(base->replay = replay_new(base, filename)))
+	  goto fail;
 
-	msecstotv(DEFAULT_NOREPLY_TIMEOUT, &base->tv_noreply);
-	msecstotv(DEFAULT_PING_INTERVAL, &base->tv_interval);
+	base->replay->paced = paced;
+	evping_now(base, &base->replay->start);
+	evping_timer_add(base, &base->replay->timer, &asap);
 
-	/* Define the callback to handle ICMP Echo Reply and add the raw file descriptor to those monitored for read events */
-	event_assign(&base->event, base->event_base, base->rawfd, EV_READ | EV_PERSIST, ready_callback, base);
-	event_add(&base->event, NULL);
+	base->done_callback = done;
+	base->done_pointer = ptr;
+	base->user_callback = callback;
+	base->user_pointer = ptr;
 
+	host = base->host_head;
+	if (host)
+	  do {
+		  host->user_callback = callback;
+		  host->user_pointer = ptr;
+		  host = host->next;
+	  } while (host != base->host_head);
+	res = 0;
+fail:
 	EVPING_UNLOCK(base);
-	return base;
+	return res;
 }
 
 
 /* exported function */
-void
-evping_base_free(struct evping_base *base, int fail_requests)
+int
+evping_simulate(struct evping_base *base, const struct timeval *tv)
 {
+	struct evping_sim *sim;
+	struct timeval end;
+	int res = -1;
+
 	EVPING_LOCK(base);
+	if (!(sim = base->sim))
+	  goto done;
 
-	EVPING_UNLOCK(base);
-	EVTHREAD_FREE_LOCK(base->lock, EVTHREAD_LOCKTYPE_RECURSIVE);
+	evutil_timeradd(&sim->now, tv, &end);
+	while (sim->ntimers && !evutil_timercmp(&sim->heap[0]->when, &end, >))
+	  {
+	    struct evping_timer *t = sim->heap[0];
 
-	mm_free(base);
+	    /* Time jumps to the next timer, which is no longer pending when it fires as with the event loop */
+	    sim->now = t->when;
+	    sim_remove(sim, t);
+	    sim->timers++;
+	    event_get_callback(&t->event)(-1, EV_TIMEOUT, event_get_callback_arg(&t->event));
+	  }
+	sim->now = end;
+	res = 0;
+done:
+	EVPING_UNLOCK(base);
+	return res;
 }
 
 
 /* exported function */
 int
-evping_base_host_add(struct evping_base *base, char * name)
+evping_host_probe(struct evping_base *base, int index, evping_callback_type callback, void *ptr)
 {
-	struct hostent *h;
+	struct timeval asap = { 0, 0 };
 	struct evhost *host;
+	int res = -1;
 
-	/* Attempt to resolv 'name' */
-	h = gethostbyname(name);
-	if (!h && inet_addr(name) == INADDR_NONE) return -1;
+	EVPING_LOCK(base);
+	host = evping_lookup_host(base, index);
 
-	host = (struct evhost *) mm_malloc(sizeof(struct evhost));
-	if (!host) return -1;
+	/* Only one request at a time */
+	if (!host || host->oneshot || evping_timer_pending(&host->ping_timer) || evping_timer_pending(&host->noreply_timer))
+		goto done;
 
-	memset(host, 0, sizeof(struct evhost));
+	if (base->prepared != base->argc)
+	  evping_prepare(base);
 
-	EVPING_LOCK(base);
+	host->user_callback = callback;
+	host->user_pointer = ptr;
+	host->oneshot = 1;
 
-	host->base = base;
-	host->name = mm_strdup(name);
-	host->saddr.sin_family = AF_INET;
-	if (h)
-	  memcpy (&host->saddr.sin_addr, h->h_addr_list[0], h->h_length);
-	else
-	  host->saddr.sin_addr.s_addr = inet_addr(name);
+	/* Schedule to immediately ping this host */
+	evhost_schedule(host, &asap);
+	res = 0;
+done:
+	EVPING_UNLOCK(base);
+	return res;
+}
 
-	/* Back to the full qualified domain address */
-	h = gethostbyaddr((char *) &host->saddr.sin_addr, sizeof(struct in_addr), AF_INET);
-	host->fqname = mm_strdup(!h || !h->h_name ? name : h->h_name);
-	host->ipname = mm_strdup(inet_ntoa(host->saddr.sin_addr));
 
-	host->index = base->argc;
-	host->seq = 1;
-	host->shortest = MAXINT;
+/* exported function */
+int
+evping_base_count_hosts(struct evping_base *base)
+{
+	int n;
 
-	/* Define here the callbacks to ping the host and to handle no reply timeouts */
-	evtimer_assign(&host->ping_timer, base->event_base, ping_callback, host);
-	evtimer_assign(&host->noreply_timer, base->event_base, noreply_callback, host);
+	EVPING_LOCK(base);
+	n = base->argc;
+	EVPING_UNLOCK(base);
+	return n;
+}
 
-	/* insert this host into the list of them */
-	if (!base->host_head) {
-	  host->next = host->prev = host;
-	  base->host_head = host;
-	} else {
-	  host->next = base->host_head->next;
-	  host->prev = base->host_head;
-	  base->host_head->next = host;
-	  if (base->host_head->prev == base->host_head) {
-	    base->host_head->prev = host;
+
+/* Summarize the results of a host */
+static void
+evhost_get_stats(struct evhost *host, struct evping_host_stats *stats)
+{
+	counter_t outcomes;
+	counter_t n;
+
+	memset(stats, 0, sizeof(*stats));
+	stats->fqname   = host->fqname;
+	stats->ipname   = host->ipname;
+	stats->sent     = host->sentpkts;
+	stats->received = host->recvpkts;
+	stats->timeouts = host->dropped;
+	stats->loss     = host->sentpkts ? 100.0 * (host->sentpkts - host->recvpkts) / host->sentpkts : 0.0;
+
+	/* Jitter and loss patterns */
+	outcomes = host->recvpkts + host->dropped;
+	stats->jitter       = host->jitter;
+	stats->loss_run     = host->lossrun;
+	stats->loss_longest = host->longestrun;
+	stats->loss_runs    = host->lossruns;
+	n = MIN(outcomes, 16);
+	stats->loss_16      = n ? 100.0 * __builtin_popcountll(host->window & 0xffff) / n : 0.0;
+	n = MIN(outcomes, 64);
+	stats->loss_64      = n ? 100.0 * __builtin_popcountll(host->window) / n : 0.0;
+
+	/* Scheduling */
+	stats->last_seen = host->lastrecv;
+	if (evping_timer_pending(&host->ping_timer))
+	  stats->next_probe = host->due;
+
+	if (host->recvpkts)
+	  {
+	    stats->min = host->shortest;
+	    stats->avg = host->sum / host->recvpkts;
+	    stats->max = host->longest;
+	    if (host->recvpkts > 1)
+	      stats->sdev = sqrt(((host->recvpkts * host->square) -
+				  (host->sum * host->sum)) / (host->recvpkts * (host->recvpkts - 1.0)));
 	  }
-	}
+}
+
 
-	base->argc++;
+/* Summarize the results of a group */
+static void
+evgroup_get_stats(struct evgroup *group, struct evping_group_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->name     = group->name;
+	stats->hosts    = group->hosts;
+	stats->losing   = group->losing;
+	stats->sent     = group->sentpkts;
+	stats->received = group->recvpkts;
+	stats->timeouts = group->dropped;
+	stats->loss     = group->recvpkts + group->dropped ? 100.0 * group->dropped / (group->recvpkts + group->dropped) : 0.0;
+	stats->loss_16  = group->outcomes16 ? 100.0 * group->lost16 / group->outcomes16 : 0.0;
+	stats->loss_64  = group->outcomes64 ? 100.0 * group->lost64 / group->outcomes64 : 0.0;
+	stats->rtt      = group->rtt;
+
+	if (group->recvpkts)
+	  {
+	    stats->min = group->shortest;
+	    stats->avg = group->sum / group->recvpkts;
+	    stats->max = group->longest;
+	    if (group->recvpkts > 1)
+	      stats->sdev = sqrt(((group->recvpkts * group->square) -
+				  (group->sum * group->sum)) / (group->recvpkts * (group->recvpkts - 1.0)));
+	  }
+}
+
+
+/* exported function */
+int
+evping_base_resolve(struct evping_base *base)
+{
+	struct sockaddr_in saddr;
+	char name [NI_MAXHOST];
+	struct evhost *host;
+	unsigned i;
+	int n = 0;
 
+	EVPING_LOCK(base);
+	for (i = 0; i < base->argc; i++)
+	  {
+	    if (!base->hosts[i]->unresolved)
+	      continue;
+	    base->hosts[i]->unresolved = 0;
+	    saddr = base->hosts[i]->saddr;
+
+	    /* Blocking, so the lock is released meanwhile (the hosts may be moved, but never removed) */
+	    EVPING_UNLOCK(base);
+	    if (getnameinfo((struct sockaddr *) &saddr, sizeof(saddr), name, sizeof(name), NULL, 0, NI_NAMEREQD))
+	      name [0] = '\0';
+	    EVPING_LOCK(base);
+
+	    host = base->hosts[i];
+	    if (name [0])
+	      {
+		base->rangemem += strlen(name);
+		base->rangemem -= strlen(host->fqname);
+		mm_free(host->fqname);
+		host->fqname = mm_strdup(name);
+		n++;
+	      }
+	  }
 	EVPING_UNLOCK(base);
-	return 0;
+
+	return n;
 }
 
 
 /* exported function */
 void
-evping_ping(struct evping_base *base, evping_callback_type callback, void *ptr)
+evping_stats(struct evping_base *base)
 {
-	struct timeval asap = { 0, 0 };
+	struct evping_host_stats stats;
 	struct evhost *host;
+	unsigned i;
 
 	EVPING_LOCK(base);
 	host = base->host_head;
 	if (!host)
 		goto done;
 	do {
-		host->user_callback = callback;
-		host->user_pointer = ptr;
+		evhost_get_stats(host, &stats);
 
-		/* Schedule to immediately ping this host */
-		evtimer_add(&host->ping_timer, &asap);
+	  	printf("--- %s ping statistics ---\n"
+		       "%lu packets transmitted, %lu received, %.2f%% packet loss, time %.1fms\n",
+		       stats.fqname, (unsigned long) stats.sent, (unsigned long) stats.received,
+		       stats.loss, host->sum / 1000.0);
+
+		if (stats.received)
+		  printf ("rtt min/avg/max/sdev = %.3f/%.3f/%.3f/%.3f ms\n",
+			  stats.min / 1000.0,
+			  stats.avg / 1000.0,
+			  stats.max / 1000.0,
+			  stats.sdev / 1000.0);
+
+		if (stats.received || stats.timeouts)
+		  printf ("jitter %.3f ms, lost in a row now/longest %lu/%lu, loss last 16/64 %.1f%%/%.1f%%\n",
+			  stats.jitter / 1000.0,
+			  (unsigned long) stats.loss_run, (unsigned long) stats.loss_longest,
+			  stats.loss_16, stats.loss_64);
+		printf ("\n");
 
 		host = host->next;
 	} while (host != base->host_head);
+
+	/* Then the groups */
+	for (i = 0; i < base->ngroups; i++) {
+		struct evping_group_stats group;
+
+		evgroup_get_stats(base->groups[i], &group);
+
+		printf("--- %s group statistics ---\n"
+		       "%u hosts (%u losing), %lu packets transmitted, %lu received, %.2f%% packet loss\n",
+		       group.name, group.hosts, group.losing, (unsigned long) group.sent,
+		       (unsigned long) group.received, group.loss);
+
+		if (group.received)
+		  printf ("rtt min/avg/max/sdev = %.3f/%.3f/%.3f/%.3f ms\n",
+			  group.min / 1000.0,
+			  group.avg / 1000.0,
+			  group.max / 1000.0,
+			  group.sdev / 1000.0);
+
+		if (group.received || group.timeouts)
+		  printf ("loss last 16/64 %.1f%%/%.1f%%\n", group.loss_16, group.loss_64);
+		printf ("\n");
+	}
 done:
 	EVPING_UNLOCK(base);
 }
@@ -627,60 +4471,152 @@ done:
 
 /* exported function */
 int
-evping_base_count_hosts(struct evping_base *base)
+evping_group_get_stats(struct evping_base *base, int index, struct evping_group_stats *stats)
 {
-	const struct evhost *host;
-	int n = 0;
+	int res = -1;
 
 	EVPING_LOCK(base);
-	host = base->host_head;
-	if (!host)
-		goto done;
-	do {
-		++n;
-		host = host->next;
-	} while (host != base->host_head);
-done:
+	if (index >= 0 && (unsigned) index < base->ngroups)
+	  {
+	    evgroup_get_stats(base->groups[index], stats);
+	    res = 0;
+	  }
+	EVPING_UNLOCK(base);
+
+	return res;
+}
+
+
+/* exported function */
+int
+evping_base_count_groups(struct evping_base *base)
+{
+	int n;
+
+	EVPING_LOCK(base);
+	n = base->ngroups;
 	EVPING_UNLOCK(base);
 	return n;
 }
 
 
 /* exported function */
-void
-evping_stats(struct evping_base *base)
+int
+evping_source_get_stats(struct evping_base *base, int index, struct evping_source_stats *stats)
+{
+	struct evping_source *source;
+	socklen_t len;
+	int res = -1;
+
+	EVPING_LOCK(base);
+	if (index >= 0 && (unsigned) index < base->nsources)
+	  {
+	    source = base->sources[index];
+
+	    memset(stats, 0, sizeof(*stats));
+	    stats->name         = source->name;
+	    stats->hosts        = source->hosts;
+	    stats->sentok       = source->sentok;
+	    stats->sendfail     = source->sendfail;
+	    stats->recvok       = source->recvok;
+	    stats->replies      = source->replies;
+	    stats->kernel_drops = source->kdrops;
+
+	    len = sizeof(stats->rcvbuf);
+	    getsockopt(source->fd, SOL_SOCKET, SO_RCVBUF, &stats->rcvbuf, &len);
+	    len = sizeof(stats->sndbuf);
+	    getsockopt(source->fd, SOL_SOCKET, SO_SNDBUF, &stats->sndbuf, &len);
+	    res = 0;
+	  }
+	EVPING_UNLOCK(base);
+
+	return res;
+}
+
+
+/* exported function */
+int
+evping_base_count_sources(struct evping_base *base)
+{
+	int n;
+
+	EVPING_LOCK(base);
+	n = base->nsources;
+	EVPING_UNLOCK(base);
+	return n;
+}
+
+
+/* exported function */
+int
+evping_host_get_stats(struct evping_base *base, int index, struct evping_host_stats *stats)
 {
 	struct evhost *host;
 
 	EVPING_LOCK(base);
-	host = base->host_head;
-	if (!host)
-		goto done;
-	do {
-	  	printf("--- %s ping statistics ---\n"
-		       "%lu packets transmitted, %lu received, %.2f%% packet loss, time %.1fms\n",
-		       host->fqname, host->sentpkts, host->recvpkts,
-		       100.0 * (host->sentpkts - host->recvpkts) / ((double) host->sentpkts),
-		       host->sum / 1000.0);
+	host = evping_lookup_host(base, index);
+	if (host)
+	  evhost_get_stats(host, stats);
+	EVPING_UNLOCK(base);
 
-		if (host->recvpkts)
-		  {
-		    double average = host->sum / host->recvpkts;
-		    double deviation = sqrt(((host->recvpkts * host->square) -
-					     (host->sum * host->sum)) / (host->recvpkts * (host->recvpkts - 1.0)));
-
-		    printf ("rtt min/avg/max/sdev = %.3f/%.3f/%.3f/%.3f ms\n\n",
-			    host->shortest / 1000.0,
-			    average / 1000.0,
-			    host->longest / 1000.0,
-			    deviation / 1000.0);
-		  }
-		else
-		  printf ("\n");
+	return host ? 0 : -1;
+}
+
+
+/* exported function */
+void
+evping_base_get_stats(struct evping_base *base, struct evping_base_stats *stats)
+{
+	socklen_t len;
+	unsigned i;
+
+	EVPING_LOCK(base);
+
+	memset(stats, 0, sizeof(*stats));
+	stats->sentok   = base->sentok;
+	stats->sendfail = base->sendfail;
+	stats->recvok   = base->recvok;
+	stats->recvfail = base->recvfail;
+	stats->tooshort = base->tooshort;
+	stats->foreign  = base->foreign;
+	stats->illegal  = base->illegal;
+	stats->kernel_drops = base->kdrops;
+	for (i = 0; i < base->nsources; i++)
+	  stats->kernel_drops += base->sources[i]->kdrops;
+
+	stats->targets      = base->ntargets;
+	stats->responders   = base->responders;
+	stats->sweeps       = base->sweeps;
+	stats->sweep_time   = tvtousecs(&base->sweeptime);
+	stats->range_memory = base->rangemem;
+	stats->pcap_drops   = base->pcap ? base->pcap->drops : 0;
+	stats->replayed     = base->replay ? base->replay->packets : 0;
+	stats->log_records  = base->log ? base->log->appended : 0;
+	stats->log_drops    = base->log ? base->log->drops : 0;
+	stats->sim_timers   = base->sim ? base->sim->timers : 0;
+	stats->sim_lost     = base->sim ? base->sim->lost : 0;
+
+#ifdef EVPING_HAVE_PACKET_RING
+	if (base->ring)
+	  {
+	    /* The kernel resets its counters each time they are read */
+	    struct tpacket_stats_v3 st;
+	    len = sizeof(st);
+	    if (getsockopt(base->ring->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == 0)
+	      base->ring->drops += st.tp_drops;
+	    stats->kernel_drops += base->ring->drops;
+	  }
+#endif
+
+	stats->timer_lateness = base->lateness;
+	stats->reply_delay    = base->delay;
+	stats->rx_queue       = base->rxqueue;
+
+	len = sizeof(stats->rcvbuf);
+	getsockopt(base->rawfd, SOL_SOCKET, SO_RCVBUF, &stats->rcvbuf, &len);
+	len = sizeof(stats->sndbuf);
+	getsockopt(base->rawfd, SOL_SOCKET, SO_SNDBUF, &stats->sndbuf, &len);
 
-		host = host->next;
-	} while (host != base->host_head);
-done:
 	EVPING_UNLOCK(base);
 }
 
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2009-2016 Rocco Carbone <rocco@tecsiel.it>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ * 3. The name of the author may not be used to endorse or promote products
+ *    derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/*
+ * C++20 coroutines on top of the ping protocol (header only).
+ *
+ *   evping::task watch(evping::pinger &p, evping::host h)
+ *   {
+ *     for (;;) {
+ *       evping::result r = co_await p.probe(h);
+ *       ...
+ *     }
+ *   }
+ *
+ * Coroutines run on the thread of the event loop of the pinger and are
+ * resumed from within the callback of the request, so no allocation is
+ * made for each probe.  The frames of the coroutines taking a pinger as
+ * their first argument are carved from a pool owned by the pinger.
+ * Coroutines still waiting when the pinger is destroyed are never resumed.
+ */
+#ifndef _EVPING_HPP_
+#define _EVPING_HPP_
+
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include <event2/event.h>
+#include <event2/evping.h>
+
+namespace evping {
+
+/* The outcome of a probe */
+struct result {
+	int error;                     /* PING_ERR_NONE or PING_ERR_TIMEOUT, see ping.h */
+	int bytes;                     /* # of bytes in the Echo Reply or -1 */
+	int seq;                       /* ICMP sequence number */
+	int ttl;                       /* IP time to live or -1 */
+	std::chrono::microseconds rtt; /* Round trip time, or time waited for nothing */
+
+	bool ok() const noexcept { return error == PING_ERR_NONE; }
+};
+
+
+class pinger;
+
+/*
+ * A host added to a pinger, as numbered by evping_base_host_add().  It can only be
+ * probed by the pinger it was obtained from.  Hosts are never removed, so it is
+ * just a handle and it owns nothing.
+ */
+class host {
+public:
+	int id() const noexcept { return id_; }
+
+private:
+	friend class pinger;
+	host(struct evping_base *base, int id) noexcept : base_(base), id_(id) {}
+
+	struct evping_base *base_;
+	int id_;
+};
+
+
+/*
+ * Free lists of coroutine frames by size classes of 64 bytes.
+ * Memory is taken from the system in chunks and only given back at destruction.
+ */
+class frame_pool {
+public:
+	frame_pool() = default;
+	frame_pool(const frame_pool &) = delete;
+	frame_pool &operator=(const frame_pool &) = delete;
+
+	~frame_pool()
+	{
+		for (void *chunk : chunks_)
+			::operator delete(chunk);
+	}
+
+	/* Get a frame from 'pool', or from the system if there is no pool */
+	static void *allocate(frame_pool *pool, std::size_t size)
+	{
+		std::size_t total = size + sizeof(header);
+		std::size_t cls = (total - 1) / granularity;
+		header *h;
+
+		if (!pool || cls >= classes) {
+			h = static_cast<header *>(::operator new(total));
+			h->pool = nullptr;
+		} else {
+			if (!pool->free_[cls])
+				pool->refill(cls);
+			node *n = pool->free_[cls];
+			pool->free_[cls] = n->next;
+			h = reinterpret_cast<header *>(n);
+			h->pool = pool;
+		}
+		h->cls = cls;
+		return h + 1;
+	}
+
+	/* Give back a frame to where it was taken from */
+	static void release(void *frame) noexcept
+	{
+		header *h = static_cast<header *>(frame) - 1;
+		frame_pool *pool = h->pool;
+		std::size_t cls = h->cls;
+
+		if (!pool) {
+			::operator delete(h);
+			return;
+		}
+		node *n = reinterpret_cast<node *>(h);
+		n->next = pool->free_[cls];
+		pool->free_[cls] = n;
+	}
+
+	/* # of bytes taken from the system so far */
+	std::size_t footprint() const noexcept { return footprint_; }
+
+private:
+	static constexpr std::size_t granularity = 64;
+	static constexpr std::size_t classes = 16;     /* Larger frames are not pooled */
+	static constexpr std::size_t per_chunk = 32;   /* # of frames taken at once */
+
+	struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) header {
+		frame_pool *pool;
+		std::size_t cls;
+	};
+
+	struct node {
+		node *next;
+	};
+
+	void refill(std::size_t cls)
+	{
+		std::size_t size = (cls + 1) * granularity;
+		char *chunk = static_cast<char *>(::operator new(size * per_chunk));
+
+		chunks_.push_back(chunk);
+		footprint_ += size * per_chunk;
+		for (std::size_t i = 0; i < per_chunk; i++) {
+			node *n = reinterpret_cast<node *>(chunk + i * size);
+			n->next = free_[cls];
+			free_[cls] = n;
+		}
+	}
+
+	node *free_[classes] = {};
+	std::vector<void *> chunks_;
+	std::size_t footprint_ = 0;
+};
+
+
+/* What co_await pinger::probe() suspends on until the request is completed/elapsed */
+class probe_awaiter {
+public:
+	probe_awaiter(struct evping_base *base, int host) noexcept : base_(base), host_(host) {}
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> handle) noexcept
+	{
+		handle_ = handle;
+		if (evping_host_probe(base_, host_, callback, this) == -1) {
+			/* Unknown host or already being probed, resume immediately */
+			result_ = { PING_ERR_UNKNOWN, -1, -1, -1, std::chrono::microseconds(0) };
+			return false;
+		}
+		return true;
+	}
+
+	result await_resume() const noexcept { return result_; }
+
+private:
+	static void callback(int res, int bytes, char *, char *, int seq, int ttl, struct timeval *elapsed, void *arg)
+	{
+		probe_awaiter *self = static_cast<probe_awaiter *>(arg);
+
+		self->result_ = { res, bytes, seq, ttl,
+				  std::chrono::microseconds(elapsed->tv_sec * 1000000LL + elapsed->tv_usec) };
+		self->handle_.resume();
+	}
+
+	struct evping_base *base_;
+	int host_;
+	std::coroutine_handle<> handle_;
+	result result_ {};
+};
+
+
+/* RAII owner of an evping_base */
+class pinger {
+public:
+	explicit pinger(struct event_base *event_base) : base_(evping_base_new(event_base))
+	{
+		if (!base_)
+			throw std::system_error(errno, std::generic_category(), "evping_base_new");
+	}
+
+	~pinger() { evping_base_free(base_, 0); }
+
+	pinger(const pinger &) = delete;
+	pinger &operator=(const pinger &) = delete;
+
+	/* See evping_base_set_option() */
+	void set_option(const char *option, const char *val)
+	{
+		if (evping_base_set_option(base_, option, val) == -1)
+			throw std::invalid_argument(std::string("evping: bad value for option ") + option);
+	}
+
+	/* Resolve and add a host, see evping_base_host_add() */
+	host add(const char *name)
+	{
+		if (evping_base_host_add(base_, const_cast<char *>(name)) == -1)
+			throw std::runtime_error(std::string("evping: cannot resolve ") + name);
+		return host(base_, evping_base_count_hosts(base_) - 1);
+	}
+
+	/* A host already added, by its number */
+	host lookup(int id) const
+	{
+		if (id < 0 || id >= evping_base_count_hosts(base_))
+			throw std::out_of_range("evping: no such host");
+		return host(base_, id);
+	}
+
+	/*
+	 * Send one ICMP ECHO_REQUEST to 'h' and suspend until it is completed/elapsed,
+	 * hosts of other pingers complete immediately with PING_ERR_UNKNOWN
+	 */
+	probe_awaiter probe(host h) noexcept { return probe_awaiter(base_, h.base_ == base_ ? h.id_ : -1); }
+
+	struct evping_base *get() const noexcept { return base_; }
+	frame_pool &pool() noexcept { return pool_; }
+
+private:
+	struct evping_base *base_;
+	frame_pool pool_;
+};
+
+
+/*
+ * A coroutine started as soon as it is called, whose frame is released
+ * when it returns.  Exceptions escaping from it terminate the program.
+ */
+struct task {
+	struct promise_type {
+		task get_return_object() noexcept { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() noexcept {}
+		void unhandled_exception() noexcept { std::terminate(); }
+
+		/* Frames of coroutines taking a pinger as their first argument come from its pool */
+		template <typename... Args>
+		static void *operator new(std::size_t size, pinger &p, Args &...)
+		{
+			return frame_pool::allocate(&p.pool(), size);
+		}
+
+		template <typename... Args>
+		static void *operator new(std::size_t size, Args &...)
+		{
+			return frame_pool::allocate(nullptr, size);
+		}
+
+		static void operator delete(void *frame) noexcept { frame_pool::release(frame); }
+	};
+};
+
+} /* namespace evping */
+
+#endif /* _EVPING_HPP_ */
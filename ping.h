@@ -59,6 +59,228 @@ typedef void (*evping_callback_type) (int result, int bytes, char * fqname, char
 struct evping_base;
 struct event_base;
 
+/**
+ * The callback invoked once all the hosts have been pinged the requested
+ * number of times (see evping_sweep()).
+ * - arg is the user data passed at the time the sweep has been started
+ */
+typedef void (*evping_done_callback_type) (struct evping_base * base, void * arg);
+
+
+/* # of buckets of a histogram */
+#define EVPING_HIST_BUCKETS 24
+
+/**
+ * A histogram with power of 2 buckets.
+ * - buckets[0] counts the values equal to 0
+ * - buckets[i] counts the values in the range [2^(i-1), 2^i) and the last one also those above
+ */
+struct evping_histogram {
+	ev_uint64_t count;             /* # of values */
+	ev_uint64_t sum;               /* Sum of the values */
+	ev_uint64_t max;               /* Largest value */
+	ev_uint64_t buckets[EVPING_HIST_BUCKETS];
+};
+
+
+/**
+ * Counters and histograms of the PING subsystem, as returned by evping_base_get_stats().
+ */
+struct evping_base_stats {
+	ev_uint64_t sentok;            /* # of ICMP Echo Requests sent */
+	ev_uint64_t sendfail;          /* # of ICMP Echo Requests failed to be sent */
+	ev_uint64_t recvok;            /* # of ICMP packets received */
+	ev_uint64_t recvfail;          /* # of failed receive operations */
+	ev_uint64_t tooshort;          /* # of ICMP packets too short */
+	ev_uint64_t foreign;           /* # of ICMP packets we are not looking for */
+	ev_uint64_t illegal;           /* # of ICMP packets with an illegal payload */
+	ev_uint64_t kernel_drops;      /* # of packets dropped by the kernel for lack of buffer space */
+
+	struct evping_histogram timer_lateness;  /* Delay of each ping over its scheduled time (usecs) */
+	struct evping_histogram reply_delay;     /* Delay between the arrival of each reply and its processing (usecs) */
+	struct evping_histogram rx_queue;        /* Receive queue depth, sampled (bytes of kernel memory) */
+
+	int rcvbuf;                    /* Actual size of the socket receive buffer (bytes) */
+	int sndbuf;                    /* Actual size of the socket send buffer (bytes) */
+
+	ev_uint64_t targets;           /* # of addresses in the ranges */
+	ev_uint64_t responders;        /* # of them which have replied at least once */
+	ev_uint64_t sweeps;            /* # of sweeps of the ranges completed */
+	ev_uint64_t sweep_time;        /* Time the last sweep took to complete (usecs) */
+	ev_uint64_t range_memory;      /* Memory held for the ranges, responders included (bytes) */
+
+	ev_uint64_t pcap_drops;        /* # of bytes not recorded since the disk was too slow */
+	ev_uint64_t replayed;          /* # of packets replayed */
+	ev_uint64_t log_records;       /* # of records appended to the probe log */
+	ev_uint64_t log_drops;         /* # of records lost since no segment was ready */
+
+	ev_uint64_t sim_timers;        /* # of timers dispatched by the virtual clock */
+	ev_uint64_t sim_lost;          /* # of requests the simulated responder has not replied to */
+};
+
+
+
+/**
+ * Summary of the results of a host, as printed by evping_stats().
+ * The strings belong to the evping_base.  Times are in microseconds
+ * and they are 0 when no reply has been received.
+ */
+struct evping_host_stats {
+	const char *fqname;            /* Full qualified hostname */
+	const char *ipname;            /* Address in dot notation */
+	ev_uint64_t sent;              /* # of ICMP Echo Requests sent */
+	ev_uint64_t received;          /* # of ICMP Echo Replies received */
+	ev_uint64_t timeouts;          /* # of ICMP Echo Requests timed out */
+	double loss;                   /* Percentage of requests with no reply */
+	double min;                    /* Round trip times */
+	double avg;
+	double max;
+	double sdev;
+
+	double jitter;                 /* RFC 3550 interarrival jitter of the round trip times */
+	ev_uint64_t loss_run;          /* # of requests lost in a row up to now */
+	ev_uint64_t loss_longest;      /* Longest run of requests lost in a row */
+	struct evping_histogram loss_runs;  /* Lengths of the runs of losses which have ended */
+	double loss_16;                /* Percentage of the last 16 requests with no reply */
+	double loss_64;                /* Percentage of the last 64 requests with no reply */
+
+	struct timeval last_seen;      /* Time the last reply was received (0 if never) */
+	struct timeval next_probe;     /* Time the next request is due (0 if none is scheduled) */
+};
+
+
+/**
+ * Summary of the results of a group of hosts, rolled up as those of its hosts
+ * are updated.  The name belongs to the evping_base.  Times are in microseconds
+ * and they are 0 when no reply has been received.
+ */
+struct evping_group_stats {
+	const char *name;              /* Name of the group */
+	ev_uint32_t hosts;             /* # of hosts in the group */
+	ev_uint32_t losing;            /* # of hosts whose last request was lost */
+	ev_uint64_t sent;              /* # of ICMP Echo Requests sent */
+	ev_uint64_t received;          /* # of ICMP Echo Replies received */
+	ev_uint64_t timeouts;          /* # of ICMP Echo Requests timed out */
+	double loss;                   /* Percentage of the requests completed with no reply */
+	double loss_16;                /* Percentage of the last 16 requests of each host with no reply */
+	double loss_64;                /* Percentage of the last 64 requests of each host with no reply */
+	double min;                    /* Round trip times */
+	double avg;
+	double max;
+	double sdev;
+	struct evping_histogram rtt;   /* Round trip times */
+};
+
+
+/**
+ * Counters of a source the hosts are probed from (see evping_base_source_add()).
+ * The name belongs to the evping_base.
+ */
+struct evping_source_stats {
+	const char *name;              /* Interface or address as given */
+	ev_uint32_t hosts;             /* # of hosts probed from it */
+	ev_uint64_t sentok;            /* # of successful sendto() */
+	ev_uint64_t sendfail;          /* # of failed sendto() */
+	ev_uint64_t recvok;            /* # of packets read from its socket */
+	ev_uint64_t replies;           /* # of replies to its hosts */
+	ev_uint64_t kernel_drops;      /* # of packets dropped by the kernel (socket buffer overflow) */
+	int rcvbuf;                    /* Socket receive buffer size (bytes) */
+	int sndbuf;                    /* Socket send buffer size (bytes) */
+};
+
+
+/**
+ * Layout of the shared memory segment published with the 'shm' option.
+ *
+ * The segment starts with a header followed by a slot per host, in the order the
+ * hosts have been added.  Each slot holds the summary counters of the host followed
+ * by a circular buffer of the most recent samples, the next one being written at
+ * position 'count' modulo 'samples'.
+ *
+ * The only writer never waits.  A reader maps the segment read-only and, for each slot:
+ *  1. loads 'seq' (acquire) and tries again later if it is odd (update in progress)
+ *  2. reads the fields of interest
+ *  3. loads 'seq' again (after an acquire fence) and retries if it has changed
+ */
+#define EVPING_SHM_MAGIC     0x65767067        /* "evpg" */
+#define EVPING_SHM_VERSION   1
+#define EVPING_SHM_TIMEOUT   0xffffffff        /* 'rtt' of a sample which timed out */
+
+struct evping_shm_header {
+	ev_uint32_t magic;             /* EVPING_SHM_MAGIC once the segment is ready */
+	ev_uint32_t version;           /* EVPING_SHM_VERSION */
+	ev_uint32_t hdr_size;          /* Offset in bytes of the first slot */
+	ev_uint32_t slot_size;         /* Size in bytes of each slot */
+	ev_uint32_t slots;             /* # of slots */
+	ev_uint32_t samples;           /* # of samples per slot */
+	ev_uint32_t pid;               /* Process identifier of the writer */
+	ev_uint32_t interval;          /* Ping interval in milliseconds */
+	ev_uint64_t started;           /* Time the segment has been created (seconds since the Epoch) */
+};
+
+struct evping_shm_sample {
+	ev_uint32_t sec;               /* Time of the sample (seconds since the Epoch) */
+	ev_uint32_t rtt;               /* Round trip time in microseconds, or EVPING_SHM_TIMEOUT */
+};
+
+struct evping_shm_slot {
+	ev_uint32_t seq;               /* Odd while the slot is being updated */
+	ev_uint32_t addr;              /* IPv4 address of the host in network byte order */
+	char name[64];                 /* Full qualified hostname (possibly truncated) */
+	ev_uint64_t count;             /* # of samples written so far */
+	ev_uint64_t replies;           /* # of ICMP Echo Replies received */
+	ev_uint64_t timeouts;          /* # of ICMP Echo Requests timed out */
+	ev_uint64_t sum;               /* Sum of the round trip times (usecs) */
+	ev_uint32_t last;              /* Last round trip time (usecs) */
+	ev_uint32_t shortest;          /* Shortest round trip time (usecs) */
+	ev_uint32_t longest;           /* Longest round trip time (usecs) */
+	ev_uint32_t pad;
+	/* followed by 'samples' struct evping_shm_sample */
+};
+
+#define EVPING_SHM_SLOT(hdr, i) \
+	((struct evping_shm_slot *) ((char *) (hdr) + (hdr)->hdr_size + (size_t) (i) * (hdr)->slot_size))
+#define EVPING_SHM_SAMPLES(slot) \
+	((struct evping_shm_sample *) ((struct evping_shm_slot *) (slot) + 1))
+
+
+/**
+ * Layout of the segment files of the probe log written with the 'log' option.
+ *
+ * Each file ("<prefix>.<segment>", segments numbered from 000000) is allocated
+ * in full when created, with room for 'records' fixed-size records following
+ * the header.  'count' is the # of records written so far, it is updated after
+ * each record (release) so that readers can follow a segment being written.
+ * A segment not full is truncated to its records when closed, 'records' then
+ * being 'count', unless that fails, so 'count' and not the size of the file
+ * tells how many there are.
+ */
+#define EVPING_LOG_MAGIC     0x6576706c        /* "evpl" */
+#define EVPING_LOG_VERSION   1
+
+struct evping_log_header {
+	ev_uint32_t magic;             /* EVPING_LOG_MAGIC */
+	ev_uint32_t version;           /* EVPING_LOG_VERSION */
+	ev_uint32_t hdr_size;          /* Offset in bytes of the first record */
+	ev_uint32_t record_size;       /* Size in bytes of each record */
+	ev_uint64_t records;           /* # of records the segment has room for */
+	ev_uint64_t count;             /* # of records written so far */
+	ev_uint32_t segment;           /* Number of the segment */
+	ev_uint32_t pid;               /* Process identifier of the writer */
+	ev_uint64_t created;           /* Time the segment has been created (seconds since the Epoch) */
+};
+
+struct evping_log_record {
+	ev_uint64_t ts;                /* Time of the outcome (nsecs since the Epoch) */
+	ev_uint32_t host;              /* Number of the host (see evping_base_host_add()) */
+	ev_uint16_t seq;               /* ICMP sequence number */
+	ev_uint8_t result;             /* PING_ERR_NONE or PING_ERR_TIMEOUT */
+	ev_uint8_t ttl;                /* IP time to live (0 on timeout) */
+	ev_uint64_t rtt;               /* Round trip time in nsecs (0 on timeout) */
+};
+
+#define EVPING_LOG_RECORD(hdr, i) \
+	((struct evping_log_record *) ((char *) (hdr) + (hdr)->hdr_size + (size_t) (i) * (hdr)->record_size))
 
 
 /**
@@ -73,6 +295,22 @@ struct event_base;
 struct evping_base * evping_base_new(struct event_base *event_base);
 
 
+/** Flag for evping_base_new_with_flags(): do not open the raw socket, so that
+    super-user permissions are not required.  Nothing can be sent or received
+    by the base itself, only from sources or while simulating. */
+#define EVPING_BASE_NO_SOCKET 0x1
+
+/**
+  Initialize the asynchronous PING library as evping_base_new() does.
+
+  @param event_base the event base to associate the ping client with
+  @param flags any combination of the EVPING_BASE_* flags
+  @return a new evping_base if successful, or NULL if an error occurred
+  @see evping_base_new(), evping_base_free()
+ */
+struct evping_base * evping_base_new_with_flags(struct event_base *event_base, int flags);
+
+
 /**
   Shut down the asynchronous PING library and terminate all active requests.
 
@@ -88,11 +326,75 @@ struct evping_base * evping_base_new(struct event_base *event_base);
 void evping_base_free(struct evping_base *base, int fail_requests);
 
 
+/**
+  Set the value of a configuration option.
+
+  The currently available configuration options are:
+
+    interval, timeout, size, quiet, io-uring, packet-ring, so-rcvbuf, so-sndbuf,
+    shm, shm-samples, pcap, backoff, log, log-records, log-segments, compact,
+    simulate, sim-rtt, sim-jitter, sim-loss, sim-dead, sim-seed.
+
+  o interval: the time in milliseconds between two subsequent pings of the same host (0 means flood mode)
+  o timeout: the time in milliseconds to wait for an ICMP Echo Reply
+  o size: the number of data bytes to be sent (it must be set before calling evping_ping() when io-uring is on)
+  o compact: non-zero to send compact probes, with the number of the host in the identifier and
+    the sequence and no data bytes unless a size is given (it can then be set from 0), whose send
+    times are kept locally; replies are only taken from the address of the host with the sequence
+    of its request outstanding, and up to 8388608 hosts are supported.  The ranges are still
+    probed with their data bytes, and captures of compact probes cannot be replayed.  It must be
+    set before calling evping_ping() when io-uring is on, and it cannot be changed once the
+    packet ring is active since its filter only takes the identifiers of the probes being sent
+  o quiet: non-zero to suppress the informational messages on standard output
+  o io-uring: non-zero to transmit and receive via io_uring (Linux only); it takes effect at the
+    time evping_ping() is called and the default transport is silently kept when not supported
+  o packet-ring: the name of the interface to receive the replies from via a memory-mapped
+    packet ring (Linux only); it takes effect at the time evping_ping() is called
+  o so-rcvbuf, so-sndbuf: the size in bytes of the socket buffers; the default of 0 sizes them
+    at the time evping_ping() is called to hold a request/reply per host
+  o shm: the name of a POSIX shared memory object (e.g. "/evping") to publish the most recent
+    samples of each host to, as described by struct evping_shm_header; it is created at the
+    time evping_ping() is called, with a slot for each host added so far
+  o shm-samples: the number of samples per host kept in the shared memory object (default 32)
+  o backoff: the cap in milliseconds of the interval of the hosts not replying, which is doubled
+    at each request lost in a row and restored by the first reply (default 0, no backoff); a cap
+    below the ping interval (the timeout in flood mode) is taken as that interval;
+    the addresses of the ranges are always swept at the ping interval
+  o log: the prefix of the names of the segment files of the probe log, to which the outcome of
+    each request is appended as described by struct evping_log_record; segments are allocated
+    and written to disk by a thread of its own, and existing files are never overwritten
+  o log-records: the # of records of each segment of the probe log (default 1048576)
+  o log-segments: the # of most recent segments kept, the older ones are removed (default 0,
+    all of them are kept); both must be set before the log option
+  o pcap: the name of a file to record every packet received to, along with the time it has
+    been received, in the pcap format (see evping_base_replay()); the file is written by a
+    thread of its own and packets are dropped rather than blocking the loop when it lags behind
+  o simulate: non-zero to run on a virtual clock (see evping_simulate()) with no packet going on
+    the wire, the requests being answered by a simulated responder; it must be set before the
+    hosts are pinged and it cannot be reset, the io-uring and packet-ring options are ignored
+  o sim-rtt: the round trip time in microseconds of the simulated responder (default 1000)
+  o sim-jitter: the upper bound in microseconds of a random delay added to each round trip (default 0)
+  o sim-loss: the % of requests the simulated responder does not reply to, at random (default 0)
+  o sim-dead: the % of hosts which never reply, chosen by their addresses (default 0);
+    the sim- options must be set after the simulate option, and sim-seed sets the seed of the
+    random numbers so that runs with the same options give the same results
+
+  @param base the evping_base to which to apply this operation
+  @param option the name of the configuration option to be modified
+  @param val the value of the configuration option
+  @return 0 if successful, or -1 if an error occurred
+ */
+int evping_base_set_option(struct evping_base *base, const char *option, const char *val);
+
+
 /**
   Add a host.
 
   The address should be an IPv4 or IPv6 address.
 
+  Hosts are numbered from 0 in the order they have been added, so the
+  number of the host just added is evping_base_count_hosts() - 1.
+
   @param base the evping_base to which to add the host
   @param address an IP address in human readable format
   @return 0 if successful, or -1 if an error occurred
@@ -100,6 +402,82 @@ void evping_base_free(struct evping_base *base, int fail_requests);
 int evping_base_host_add(struct evping_base *base, char *name);
 
 
+/**
+  Add a group of hosts.
+
+  Groups are numbered from 0 in the order they have been added, and adding
+  a group with the name of an existing one gives the number of the latter.
+  The results of the hosts of a group are rolled up as they are updated,
+  so that getting those of the group does not depend on its size.
+
+  @param base the evping_base to which to add the group
+  @param name the name of the group (a site, a rack)
+  @return the number of the group if successful, or -1 if an error occurred
+  @see evping_host_add(), evping_group_get_stats()
+ */
+int evping_base_group_add(struct evping_base *base, const char *name);
+
+
+/**
+  Add a source the hosts can be probed from.
+
+  A raw socket of its own is bound either to a source address, when the
+  source is given as an IPv4 address, or else to an interface (SO_BINDTODEVICE)
+  so that the requests leave through it whatever the routes are.  Each source
+  reads the replies to its hosts from its socket with its own read event.
+  The default socket is not read while all the hosts are probed from sources
+  (and no range is swept), since it gets a copy of all their replies.
+  The io-uring and packet-ring options only apply to the default socket.
+
+  Sources are numbered from 0 in the order they have been added.
+
+  @param base the evping_base to which to add the source
+  @param source an IPv4 address or the name of an interface
+  @return the number of the source if successful, or -1 if an error occurred
+  @see evping_host_add(), evping_source_get_stats()
+ */
+int evping_base_source_add(struct evping_base *base, const char *source);
+
+
+/**
+  Add a host tagged with a group and probed from a source.
+
+  This is the same as evping_base_host_add(), except that the host is
+  tagged with the given group for its whole life and probed from the given
+  source.  With EVPING_SOURCE_ALL a host is added per source, in the order
+  of the sources and all of them in the group, so that each path to the host
+  is measured separately; either all of them are added or none.
+
+  @param base the evping_base to which to add the host
+  @param address an IP address in human readable format
+  @param group the number of the group (see evping_base_group_add()), or -1 for none
+  @param source the number of the source (see evping_base_source_add()),
+    -1 for the default socket or EVPING_SOURCE_ALL
+  @return 0 if successful, or -1 if an error occurred
+ */
+#define EVPING_SOURCE_ALL -2
+
+int evping_host_add(struct evping_base *base, char *name, int group, int source);
+
+
+/**
+  Add a range of addresses.
+
+  The range is given as an IPv4 prefix in CIDR notation ("10.20.0.0/16"),
+  or as a single address.  Its addresses are swept by evping_ping() in
+  batches at the ping interval, and they are neither resolved nor given a
+  host descriptor until they reply for the first time, so that large ranges
+  are cheap.  The network and the broadcast addresses are not swept.
+  Only the replies are reported to the callback, with the addresses in
+  dot notation as their names until evping_base_resolve() is called.
+
+  @param base the evping_base to which to add the range
+  @param prefix an address with an optional prefix length from 8 to 32
+  @return 0 if successful, or -1 if an error occurred
+ */
+int evping_base_range_add(struct evping_base *base, const char *prefix);
+
+
 /**
   Send ICMP ECHO_REQUEST to network hosts.
 
@@ -112,6 +490,81 @@ int evping_base_host_add(struct evping_base *base, char *name);
 void evping_ping(struct evping_base *base, evping_callback_type callback, void *ptr);
 
 
+/**
+  Send a given number of ICMP ECHO_REQUEST to each network host, then stop.
+
+  This is the same as evping_ping(), except that each host (and each address
+  of the ranges) stops being pinged once it has been probed 'count' times,
+  that is once its requests have either been replied or elapsed.
+  The done callback is invoked once all of them are done.
+
+  @param base the evping_base to which to apply this operation
+  @param count the number of requests to send to each host
+  @param callback a callback function to invoke when each request is completed/elapsed
+  @param done a callback function to invoke when all the hosts are done
+  @param ptr an argument to pass to the callback functions
+ */
+void evping_sweep(struct evping_base *base, int count, evping_callback_type callback,
+		  evping_done_callback_type done, void *ptr);
+
+
+/**
+  Replay the packets recorded with the 'pcap' option through the receive path.
+
+  The packets are decoded and accounted exactly as if they were received,
+  either as fast as possible or at their original pace, and nothing is sent.
+  The identifier of the requests is taken from the capture, and when no host
+  has been added the hosts are created from the capture as well.
+  The replies to the sweeps of ranges are only related to their targets when
+  the same ranges have been added in the same order.
+
+  @param base the evping_base to which to apply this operation
+  @param filename the pcap file
+  @param paced non zero to replay at the original pace
+  @param callback a callback function to invoke when each reply is decoded
+  @param done a callback function to invoke at the end of the capture
+  @param ptr an argument to pass to the callback functions
+  @return 0 if successful, or -1 if the file cannot be read or it is not a capture of raw IPv4 packets
+ */
+int evping_base_replay(struct evping_base *base, const char *filename, int paced,
+		       evping_callback_type callback, evping_done_callback_type done, void *ptr);
+
+
+/**
+  Run the virtual clock for a given time.
+
+  The timers due in that time are dispatched in order, time jumping from one
+  to the next, so that hours of probing take as long as processing the probes
+  does and the results are the same at each run.  The callbacks are invoked as
+  they would be from the event loop, which is not involved, but they must not
+  free the base.  The virtual clock starts at the time the simulate option is
+  set and it is at the end of the given time on return.
+
+  @param base the evping_base to which to apply this operation
+  @param tv the time to simulate
+  @return 0 if successful, or -1 if the simulate option is not set
+  @see evping_base_set_option()
+ */
+int evping_simulate(struct evping_base *base, const struct timeval *tv);
+
+
+/**
+  Send one ICMP ECHO_REQUEST to an added host.
+
+  The callback is invoked exactly once, either when the reply is received
+  or when the request is elapsed, and the host is not pinged again unless
+  it is probed once more (it is safe to do so from the callback itself).
+  This is an alternative to evping_ping() for the hosts it is used for.
+
+  @param base the evping_base to which to apply this operation
+  @param host the number of the host (see evping_base_host_add())
+  @param callback a callback function to invoke when the request is completed/elapsed
+  @param ptr an argument to pass to the callback function
+  @return 0 if successful, or -1 if the host is unknown or it is already being pinged
+ */
+int evping_host_probe(struct evping_base *base, int host, evping_callback_type callback, void *ptr);
+
+
 /**
   Get the number of added hosts.
 
@@ -128,13 +581,93 @@ int evping_base_count_hosts(struct evping_base *base);
 
 
 /**
-  Send ICMP ECHO_REQUEST to network hosts.
+  Look up the reverse names of the addresses of the ranges which have replied.
+
+  The lookups are blocking, so this is meant to be called before printing
+  or getting the statistics, and never from a callback.  The base is not
+  locked meanwhile.
+
+  @param base the evping_base to which to apply this operation
+  @return the number of names found
+ */
+int evping_base_resolve(struct evping_base *base);
+
+
+/**
+  Print the summary of the results of each host.
 
   @param base the evping_base to which to apply this operation
  */
 void evping_stats(struct evping_base *base);
 
 
+/**
+  Get the summary of the results of a host.
+
+  The reverse names of the addresses of the ranges are only there once
+  looked up by evping_base_resolve().
+
+  @param base the evping_base to which to apply this operation
+  @param host the number of the host (see evping_base_host_add())
+  @param stats the structure to be filled in
+  @return 0 if successful, or -1 if the host is unknown
+ */
+int evping_host_get_stats(struct evping_base *base, int host, struct evping_host_stats *stats);
+
+
+/**
+  Get the number of added groups.
+
+  @param base the evping_base to which to apply this operation
+  @return the number of groups
+  @see evping_base_group_add()
+ */
+int evping_base_count_groups(struct evping_base *base);
+
+
+/**
+  Get the summary of the results of a group of hosts, in constant time.
+
+  @param base the evping_base to which to apply this operation
+  @param group the number of the group (see evping_base_group_add())
+  @param stats the structure to be filled in
+  @return 0 if successful, or -1 if the group is unknown
+ */
+int evping_group_get_stats(struct evping_base *base, int group, struct evping_group_stats *stats);
+
+
+/**
+  Get the number of added sources.
+
+  @param base the evping_base to which to apply this operation
+  @return the number of sources
+  @see evping_base_source_add()
+ */
+int evping_base_count_sources(struct evping_base *base);
+
+
+/**
+  Get the counters of a source.
+
+  @param base the evping_base to which to apply this operation
+  @param source the number of the source (see evping_base_source_add())
+  @param stats the structure to be filled in
+  @return 0 if successful, or -1 if the source is unknown
+ */
+int evping_source_get_stats(struct evping_base *base, int source, struct evping_source_stats *stats);
+
+
+/**
+  Get the counters and the histograms of the PING subsystem.
+
+  They are updated at negligible cost while pinging and can be read at any time.
+
+  @param base the evping_base to which to apply this operation
+  @param stats the structure to be filled in
+ */
+void evping_base_get_stats(struct evping_base *base, struct evping_base_stats *stats);
+
+
 /**
   Convert a PING error code to a string.
 